@@ -1,9 +1,114 @@
 
 
-def add_cswrapper(filename, outfilename=None):
+def jacobian_sparsity(model_description, root):
+    """ Get the sparsity pattern of the Jacobian of the derivatives w.r.t. the continuous states
+    in compressed sparse column format from the dependencies of the derivatives in the model
+    structure. Derivatives without dependency information depend on all states. The diagonal
+    elements are always included.
+
+    Parameters:
+        model_description  the model description of the FMU
+        root               the root element of the modelDescription.xml
+
+    Returns:
+        (colptrs, rowvals)
+    """
+
+    states = dict((id(d.variable.derivative), i) for i, d in enumerate(model_description.derivatives))
+
+    nx = len(states)
+
+    columns = [{j} for j in range(nx)]
+
+    for i, unknown in enumerate(root.findall('ModelStructure/Derivatives/Unknown')):
+
+        dependencies = unknown.get('dependencies')
+
+        if dependencies is None:
+            for column in columns:
+                column.add(i)
+            continue
+
+        for index in dependencies.split():
+            variable = model_description.modelVariables[int(index) - 1]
+            j = states.get(id(variable))
+            if j is not None:
+                columns[j].add(i)
+
+    colptrs = [0]
+    rowvals = []
+
+    for column in columns:
+        rowvals += sorted(column)
+        colptrs.append(len(rowvals))
+
+    return colptrs, rowvals
+
+
+def column_colors(colptrs, rowvals):
+    """ Greedily color the columns of a sparsity pattern such that columns of the same color
+    have no rows in common and can be evaluated together when computing the Jacobian
+
+    Parameters:
+        colptrs  the column pointers of the pattern in compressed sparse column format
+        rowvals  the row indices of the pattern
+
+    Returns:
+        the colors of the columns starting at 0
+    """
+
+    colors = []
+    rows = []  # the rows occupied by each color
+
+    for j in range(len(colptrs) - 1):
+
+        column = set(rowvals[colptrs[j]:colptrs[j + 1]])
+
+        for color, occupied in enumerate(rows):
+            if occupied.isdisjoint(column):
+                occupied.update(column)
+                break
+        else:
+            color = len(rows)
+            rows.append(column)
+
+        colors.append(color)
+
+    return colors
+
+
+def add_cswrapper(filename, outfilename=None, linear_solver='dense', directional_derivatives=True, method='bdf',
+                  nonlinear_solver=None, relative_tolerance=None, dense_output=True):
+    """ Add a Co-Simulation interface to an FMI 2.0 Model Exchange FMU that solves the model with CVode
+
+    Parameters:
+        filename       filename of the FMU
+        outfilename    filename of the FMU with the wrapper (None: overwrite the FMU)
+        linear_solver  linear solver for the Newton iteration: 'dense' or 'sparse' to exploit the
+                       sparsity of the Jacobian given by the dependencies in the model structure.
+                       'sparse' uses a sparse matrix and the KLU solver only if the wrapper has been
+                       built with CSWRAPPER_KLU. Otherwise it uses a band matrix with the bandwidth of
+                       the sparsity pattern or, if the pattern is not banded, the dense solver.
+        directional_derivatives
+                       compute the Jacobian from directional derivatives if the FMU provides them
+        method         linear multistep method: 'bdf' for stiff or 'adams' for non-stiff models
+        nonlinear_solver
+                       nonlinear solver: 'newton' or 'fixedpoint' (None: 'newton' for 'bdf' and
+                       'fixedpoint' for 'adams')
+        relative_tolerance
+                       relative tolerance if none is passed to fmi2SetupExperiment() (None: 1e-4).
+                       The absolute tolerances are scaled by the nominal values of the states.
+        dense_output   let the solver step beyond the communication points and interpolate the states.
+                       If an input changes after the solver has stepped beyond a communication point,
+                       it is restarted at that point, which discards the step size and order and
+                       starts over with a small first-order step. Setting an input to its current
+                       value does not restart the solver. Set it to False for inputs that change at
+                       (almost) every step.
+    """
 
     from lxml import etree
     import os
+    import msgpack
     from shutil import copyfile, rmtree
     from fmpy import read_model_description, extract, sharedLibraryExtension, platform, __version__
     from fmpy.util import create_zip_archive
@@ -11,6 +116,18 @@ def add_cswrapper(filename, outfilename=None):
     if outfilename is None:
         outfilename = filename
 
+    if linear_solver not in ['dense', 'sparse']:
+        raise Exception('linear_solver must be "dense" or "sparse".')
+
+    if method not in ['bdf', 'adams']:
+        raise Exception('method must be "bdf" or "adams".')
+
+    if nonlinear_solver not in [None, 'newton', 'fixedpoint']:
+        raise Exception('nonlinear_solver must be None, "newton" or "fixedpoint".')
+
+    if relative_tolerance is not None and relative_tolerance <= 0:
+        raise Exception('relative_tolerance must be greater than zero.')
+
     model_description = read_model_description(filename)
 
     if model_description.fmiVersion != '2.0':
@@ -35,9 +152,7 @@ def add_cswrapper(filename, outfilename=None):
     for e in root.findall('CoSimulation'):
         root.remove(e)
 
-    for i, child in enumerate(root):
-        if child.tag == 'ModelExchange':
-            break
+    model_exchange = root.find('ModelExchange')
 
     model_identifier = '%s_%s_%s' % (model_description.modelExchange.modelIdentifier,
                                      model_description.numberOfContinuousStates,
@@ -45,10 +160,46 @@ def add_cswrapper(filename, outfilename=None):
 
     e = etree.Element("CoSimulation")
     e.attrib['modelIdentifier'] = model_identifier
-    root.insert(i + 1, e)
+
+    # the wrapper supports the FMU state if the model does
+    for name in ['canGetAndSetFMUstate', 'canSerializeFMUstate']:
+        if model_exchange.get(name) is not None:
+            e.attrib[name] = model_exchange.get(name)
+
+    root.insert(list(root).index(model_exchange) + 1, e)
 
     tree.write(xml, pretty_print=True, encoding='utf-8')
 
+    # options of the wrapper (see src/cswrapper/cswrapper.c)
+    config = {'method': method, 'linearSolver': linear_solver, 'denseOutput': dense_output}
+
+    if nonlinear_solver is not None:
+        config['nonlinearSolver'] = nonlinear_solver
+
+    if relative_tolerance is not None:
+        config['relativeTolerance'] = float(relative_tolerance)
+
+    use_directional_derivatives = directional_derivatives and \
+        model_description.modelExchange.providesDirectionalDerivative
+
+    if linear_solver == 'sparse' or use_directional_derivatives:
+        colptrs, rowvals = jacobian_sparsity(model_description, root)
+        config['colptrs'] = colptrs
+        config['rowvals'] = rowvals
+        config['colors'] = column_colors(colptrs, rowvals)
+
+    if use_directional_derivatives:
+        config['directionalDerivatives'] = True
+        config['states'] = [d.variable.derivative.valueReference for d in model_description.derivatives]
+        config['derivatives'] = [d.variable.valueReference for d in model_description.derivatives]
+
+    resources_dir = os.path.join(unzipdir, 'resources')
+
+    os.makedirs(resources_dir, exist_ok=True)
+
+    with open(os.path.join(resources_dir, 'cswrapper.mp'), 'wb') as f:
+        f.write(msgpack.packb(config))
+
     shared_library = os.path.join(os.path.dirname(__file__), 'cswrapper' + sharedLibraryExtension)
     license_file = os.path.join(os.path.dirname(__file__), 'license.txt')
 
@@ -62,3 +213,55 @@ def add_cswrapper(filename, outfilename=None):
     create_zip_archive(outfilename, unzipdir)
 
     rmtree(unzipdir, ignore_errors=True)
+
+
+def do_step_ensemble(instances, current_time, step_size, n_steps=1, output=None, threads=0):
+    """ Advance initialized instances of the same FMU with the Co-Simulation wrapper in parallel
+
+    Parameters:
+        instances      list of fmpy.fmi2.FMU2Slave instances of the FMU that share the same platform binary
+        current_time   current communication point
+        step_size      communication step size
+        n_steps        number of communication steps
+        output         value references of the Real variables to record after every step
+        threads        number of threads (0: number of processors)
+
+    Returns:
+        array of shape (len(instances), n_steps, len(output)) with the recorded values
+    """
+
+    from ctypes import c_void_p, c_size_t, c_double, c_int, c_uint, POINTER
+    import numpy as np
+    from fmpy.fmi2 import fmi2OK, fmi2Warning
+
+    if len(instances) == 0:
+        raise Exception("instances must not be empty.")
+
+    dll = instances[0].dll
+
+    if any(instance.dll._handle != dll._handle for instance in instances):
+        raise Exception("All instances must share the same platform binary.")
+
+    output = [] if output is None else list(output)
+
+    n = len(instances)
+
+    components = (c_void_p * n)(*[instance.component for instance in instances])
+    vr = (c_uint * len(output))(*output)
+    values = np.zeros((n, n_steps, len(output)))
+    status = (c_int * n)()
+
+    f = dll.cswrapperDoStepEnsemble
+    f.argtypes = [POINTER(c_void_p), c_size_t, c_double, c_double, c_size_t, POINTER(c_uint), c_size_t,
+                  POINTER(c_double), c_size_t, POINTER(c_int)]
+    f.restype = c_int
+
+    f(components, n, current_time, step_size, n_steps, vr, len(output),
+      values.ctypes.data_as(POINTER(c_double)), threads, status)
+
+    failed = [i for i, s in enumerate(status) if s > fmi2Warning]
+
+    if failed:
+        raise Exception("Failed to advance the instances %s." % failed)
+
+    return values
@@ -29,6 +29,8 @@ class Component(object):
 
     filename: PathLike
     name: str
+    stepSize: float = None
+    interpolation: str = 'Hold'
 
 
 @attrs(eq=False, auto_attribs=True)
@@ -38,6 +40,7 @@ class Connection(object):
     startConnector: str
     endElement: str
     endConnector: str
+    delayed: bool = False
 
 
 @attrs(eq=False, auto_attribs=True)
@@ -58,7 +61,17 @@ class Configuration(object):
 
     defaultExperiment = attrib(type=DefaultExperiment, default=None, repr=False)
 
+    masterAlgorithm = attrib(type=str, default='Jacobi', repr=False)
+
+    # fixed-point iteration over the connections that use the values of the previous step
+    maxIterations = attrib(type=int, default=None, repr=False)
+    iterationTolerance = attrib(type=float, default=None, repr=False)
+
     parallelDoStep = attrib(type=bool, default=False, repr=False)
+    threads = attrib(type=int, default=None, repr=False)
+
+    # record the timing of the components and log a summary when the instance is freed
+    statistics = attrib(type=bool, default=False, repr=False)
 
     unitDefinitions = attrib(type=List[Unit], default=Factory(list), repr=False)
     typeDefinitions = attrib(type=List[SimpleType], default=Factory(list), repr=False)
@@ -95,6 +108,94 @@ FMI_TYPES = {
 }
 
 
+def pack_config(data):
+    """ Pack the container configuration into the flat layout of config.bin (see src/fmucontainer/Config.h) """
+
+    import struct
+
+    strings = bytearray()
+
+    def add_string(value):
+        offset = len(strings)
+        strings.extend(value.encode('utf-8') + b'\0')
+        return offset
+
+    components = bytearray()
+
+    for c in data['components']:
+        components += struct.pack('<QQQQdII',
+                                  add_string(c['name']),
+                                  add_string(c['fmiVersion']),
+                                  add_string(c['guid']),
+                                  add_string(c['modelIdentifier']),
+                                  c.get('stepSize', 0.0),
+                                  ['Hold', 'Linear'].index(c.get('interpolation', 'Hold')),
+                                  c.get('eventModeUsed', False) * 1 |
+                                  c.get('earlyReturnAllowed', False) * 2 |
+                                  c.get('canGetAndSetFMUState', False) * 4)
+
+    connections = bytearray()
+
+    for c in data['connections']:
+        connections += struct.pack('<IIQQIIQ',
+                                   c['type'],
+                                   c.get('delayed', False),
+                                   c['startComponent'],
+                                   c['endComponent'],
+                                   c['startValueReference'],
+                                   c['endValueReference'],
+                                   c.get('size', 1))
+
+    variables = bytearray()
+    mappings = bytearray()
+    n_mappings = 0
+
+    for v in data['variables']:
+
+        start = v.get('start')
+
+        if start is None:
+            packed_start = bytes(8)
+        elif v['type'] in [FMI_TYPES['Float32'], FMI_TYPES['Float64']]:
+            packed_start = struct.pack('<d', start)
+        elif v['type'] in [FMI_TYPES['UInt8'], FMI_TYPES['UInt16'], FMI_TYPES['UInt32'], FMI_TYPES['UInt64']]:
+            packed_start = struct.pack('<Q', int(start))
+        elif v['type'] == FMI_TYPES['String']:
+            packed_start = struct.pack('<Q', add_string(start))
+        elif v['type'] == FMI_TYPES['Binary']:
+            packed_start = struct.pack('<Q', len(strings))
+            strings.extend(struct.pack('<Q', len(start)) + start)
+        else:
+            packed_start = struct.pack('<q', int(start))
+
+        variables += struct.pack('<IIQQ', v['type'], start is not None, n_mappings, len(v['components'])) + packed_start
+
+        for component, value_reference in zip(v['components'], v['valueReferences']):
+            mappings += struct.pack('<QII', component, value_reference, 0)
+
+        n_mappings += len(v['components'])
+
+    # the string table ends with a null character even if the last entry is a Binary
+    strings += b'\0'
+
+    header = struct.pack('<8sIIIIQQdQQQQQ',
+                         b'FMUCONF\0',
+                         2,
+                         data['parallelDoStep'],
+                         ['Jacobi', 'GaussSeidel'].index(data['masterAlgorithm']),
+                         data.get('statistics', False),
+                         data.get('threads', 0),
+                         data.get('maxIterations', 0),
+                         data.get('iterationTolerance', 1e-6),
+                         len(data['components']),
+                         len(data['connections']),
+                         len(data['variables']),
+                         n_mappings,
+                         len(strings))
+
+    return header + components + connections + variables + mappings + strings
+
+
 def create_fmu_container(configuration, output_filename):
     """ Create an FMU from nested FMUs (experimental)
 
@@ -130,6 +231,13 @@ def create_fmu_container(configuration, output_filename):
     if configuration.fmiVersion not in ['2.0', '3.0']:
         raise Exception(f"fmiVersion must be '2.0' or '3.0' but was { configuration.fmiVersion }.")
 
+    if configuration.masterAlgorithm not in ['Jacobi', 'GaussSeidel']:
+        raise Exception(f"masterAlgorithm must be 'Jacobi' or 'GaussSeidel' but was { configuration.masterAlgorithm }.")
+
+    for component in configuration.components:
+        if component.interpolation not in ['Hold', 'Linear']:
+            raise Exception(f"interpolation must be 'Hold' or 'Linear' but was { component.interpolation }.")
+
     output_filename = Path(output_filename)
     base_filename, _ = os.path.splitext(output_filename)
     model_name = os.path.basename(base_filename)
@@ -158,6 +266,12 @@ def create_fmu_container(configuration, output_filename):
         'FMI3.h',
         'FMUContainer.c',
         'FMUContainer.h',
+        'ThreadPool.c',
+        'ThreadPool.h',
+        'Config.c',
+        'Config.h',
+        'Statistics.c',
+        'Statistics.h',
         'mpack.h',
         'mpack-common.c',
         'mpack-common.h',
@@ -184,18 +298,40 @@ def create_fmu_container(configuration, output_filename):
     """ 
 
     data = {
+        'masterAlgorithm': configuration.masterAlgorithm,
         'parallelDoStep': configuration.parallelDoStep,
         'components': [],
         'variables': [],
         'connections': []
     }
 
+    if configuration.threads is not None:
+        data['threads'] = configuration.threads
+
+    if configuration.statistics:
+        data['statistics'] = True
+
+    if configuration.maxIterations is not None:
+        data['maxIterations'] = configuration.maxIterations
+
+    if configuration.iterationTolerance is not None:
+        data['iterationTolerance'] = float(configuration.iterationTolerance)
+
     component_map = {}
 
     platforms = []
 
+    # the container can only get and set its state if all components can
+    can_get_and_set_fmu_state = True
+    can_serialize_fmu_state = True
+
+    # the container can return early if it can roll back the components to an event
+    might_return_early = False
+
     for i, component in enumerate(configuration.components):
         model_description = read_model_description(component.filename)
+        can_get_and_set_fmu_state &= model_description.coSimulation.canGetAndSetFMUstate
+        can_serialize_fmu_state &= model_description.coSimulation.canSerializeFMUstate
         model_identifier = model_description.coSimulation.modelIdentifier
         extract(component.filename, unzipdir / 'resources' / model_identifier)
         variables = dict((v.name, v) for v in model_description.modelVariables)
@@ -208,12 +344,29 @@ def create_fmu_container(configuration, output_filename):
             'modelIdentifier': model_identifier,
         }
 
+        # FMI 3.0 components with event mode may stop at their events
+        if model_description.fmiVersion.startswith('3') and model_description.coSimulation.hasEventMode:
+            c['eventModeUsed'] = True
+            if model_description.coSimulation.mightReturnEarlyFromDoStep:
+                c['earlyReturnAllowed'] = True
+                might_return_early = True
+
+        if model_description.coSimulation.canGetAndSetFMUstate:
+            c['canGetAndSetFMUState'] = True
+
+        if component.stepSize is not None:
+            c['stepSize'] = float(component.stepSize)
+            c['interpolation'] = component.interpolation
+
         data['components'].append(c)
 
         platforms.append(set(supported_platforms(component.filename)))
 
     platforms = platforms[0].intersection(*platforms[1:])  # platforms supported by all components
 
+    if configuration.maxIterations is not None and configuration.maxIterations > 1 and not can_get_and_set_fmu_state:
+        raise Exception("The iteration requires that all components can get and set their FMU state.")
+
     platform_map = {
         'darwin64': 'x86_64-darwin',
         'linux64': 'x86_64-linux',
@@ -243,6 +396,9 @@ def create_fmu_container(configuration, output_filename):
         # config.mp
         for component_name, variable_name in v.mapping:
             component_index, component_variables = component_map[component_name]
+            if getattr(component_variables[variable_name], 'shape', ()):
+                raise Exception(f'The array variable {component_name}.{variable_name} cannot be mapped to variable "{v.name}".'
+                                ' Array variables can only be connected.')
             value_reference = component_variables[variable_name].valueReference
             component_indices.append(component_index)
             value_references.append(value_reference)
@@ -254,9 +410,13 @@ def create_fmu_container(configuration, output_filename):
         }
 
         if v.start is not None:
-            if v.type in ['Float64', 'Real']:
+            # container variables map to scalars (see above)
+            if isinstance(v.start, (list, tuple)):
+                raise Exception(f'The start value of variable "{v.name}" must be a scalar.'
+                                ' Array start values are not supported.')
+            if v.type in ['Float32', 'Float64', 'Real']:
                 variable['start'] = float(v.start)
-            elif v.type in ['Int32', 'Integer', 'Enumeration']:
+            elif v.type in ['Int8', 'UInt8', 'Int16', 'UInt16', 'Int32', 'UInt32', 'Int64', 'UInt64', 'Integer', 'Enumeration']:
                 variable['start'] = int(v.start)
             elif v.type == 'Boolean':
                 if isinstance(v.start, str):
@@ -269,17 +429,44 @@ def create_fmu_container(configuration, output_filename):
                     variable['start'] = bool(v.start)
             elif v.type == 'String':
                 variable['start'] = v.start
+            elif v.type == 'Binary':
+                variable['start'] = bytes.fromhex(v.start) if isinstance(v.start, str) else bytes(v.start)
 
         data['variables'].append(variable)
 
     for c in configuration.connections:
-        data['connections'].append({
-            'type': FMI_TYPES[component_map[c.startElement][1][c.startConnector].type],
+
+        start_variable = component_map[c.startElement][1][c.startConnector]
+        end_variable = component_map[c.endElement][1][c.endConnector]
+
+        start_shape = getattr(start_variable, 'shape', ())
+        end_shape = getattr(end_variable, 'shape', ())
+
+        if start_shape != end_shape:
+            raise Exception(f'The connection from {c.startElement}.{c.startConnector} to {c.endElement}.{c.endConnector}'
+                            f' connects variables with different shapes {start_shape} and {end_shape}.')
+
+        connection = {
+            'type': FMI_TYPES[start_variable.type],
             'startComponent': component_map[c.startElement][0],
             'endComponent': component_map[c.endElement][0],
-            'startValueReference': component_map[c.startElement][1][c.startConnector].valueReference,
-            'endValueReference': component_map[c.endElement][1][c.endConnector].valueReference,
-        })
+            'startValueReference': start_variable.valueReference,
+            'endValueReference': end_variable.valueReference,
+        }
+
+        if c.delayed:
+            connection['delayed'] = True
+
+        # arrays are transferred as a whole
+        size = 1
+
+        for dimension in start_shape:
+            size *= dimension
+
+        if size != 1:
+            connection['size'] = size
+
+        data['connections'].append(connection)
 
     loader = jinja2.FileSystemLoader(searchpath=Path(__file__).parent / 'templates')
 
@@ -306,7 +493,10 @@ def create_fmu_container(configuration, output_filename):
         modelName=model_name,
         description=configuration.description,
         generationDateAndTime=datetime.now(timezone.utc).isoformat(),
-        fmpyVersion=fmpy.__version__
+        fmpyVersion=fmpy.__version__,
+        canGetAndSetFMUState=can_get_and_set_fmu_state,
+        canSerializeFMUState=can_get_and_set_fmu_state and can_serialize_fmu_state,
+        mightReturnEarlyFromDoStep=might_return_early and can_get_and_set_fmu_state
     )
 
     # print(xml)
@@ -318,6 +508,10 @@ def create_fmu_container(configuration, output_filename):
         packed = msgpack.packb(data)
         f.write(packed)
 
+    # flat layout that is memory mapped by the container
+    with open(unzipdir / 'resources' / 'config.bin', 'wb') as f:
+        f.write(pack_config(data))
+
     shutil.make_archive(base_filename, 'zip', unzipdir)
     print(unzipdir, base_filename, output_filename)
 
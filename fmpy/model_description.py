@@ -47,6 +47,7 @@ class CoSimulation(InterfaceType):
     canInterpolateInputs = attrib(type=bool, default=False, repr=False)
     providesIntermediateUpdate = attrib(type=bool, default=False, repr=False)
     canReturnEarlyAfterIntermediateUpdate = attrib(type=bool, default=False, repr=False)
+    mightReturnEarlyFromDoStep = attrib(type=bool, default=False, repr=False)
     hasEventMode = attrib(type=bool, default=False, repr=False)
     providesEvaluateDiscreteStates = attrib(type=bool, default=False, repr=False)
     canRunAsynchronuously = attrib(type=bool, default=False, repr=False)
@@ -18,13 +18,26 @@
 #include <nvector/nvector_serial.h>    /* access to serial N_Vector            */
 #include <sunmatrix/sunmatrix_dense.h> /* access to dense SUNMatrix            */
 #include <sunlinsol/sunlinsol_dense.h> /* access to dense SUNLinearSolver      */
+#include <sunmatrix/sunmatrix_band.h>  /* access to band SUNMatrix             */
+#include <sunlinsol/sunlinsol_band.h>  /* access to band SUNLinearSolver       */
+#include <sunnonlinsol/sunnonlinsol_fixedpoint.h> /* access to fixed point SUNNonlinearSolver */
+#ifdef CSWRAPPER_KLU
+#include <sunmatrix/sunmatrix_sparse.h> /* access to sparse SUNMatrix          */
+#include <sunlinsol/sunlinsol_klu.h>    /* access to KLU SUNLinearSolver       */
+#endif
 #include <sundials/sundials_types.h>   /* defs. of realtype, sunindextype      */
 
+#include <mpack.h>
+
 #include "fmi2Functions.h"
+#include "ThreadPool.h"
 
 
 #define EPSILON 1e-14
-#define RTOL  RCONST(1.0e-4)   /* scalar relative tolerance            */
+#define RTOL  RCONST(1.0e-4)   /* default relative tolerance           */
+
+/* square root of the unit roundoff used to perturb the states */
+#define SQRT_UROUND RCONST(1.4901161193847656e-08)
 
 #if defined(_WIN32)
 #define SHARED_LIBRARY_EXTENSION ".dll"
@@ -34,6 +47,27 @@
 #define SHARED_LIBRARY_EXTENSION ".so"
 #endif
 
+typedef enum {
+
+    BDF,
+    Adams
+
+} Method;
+
+typedef enum {
+
+    Newton,
+    FixedPoint
+
+} NonlinearSolver;
+
+typedef enum {
+
+    Dense,
+    Sparse
+
+} LinearSolver;
+
 typedef struct {
 
 #if defined(_WIN32)
@@ -46,6 +80,7 @@ typedef struct {
     fmi2EventInfo eventInfo;
 	fmi2CallbackLogger logger;
 	const char *instanceName;
+    fmi2Boolean loggingOn;
     
     size_t nx;
     size_t nz;
@@ -55,6 +90,64 @@ typedef struct {
     N_Vector abstol;
 	SUNMatrix A;
 	SUNLinearSolver LS;
+    SUNNonlinearSolver NLS;
+
+    // linear multistep method and nonlinear solver of CVode
+    Method method;
+    NonlinearSolver nonlinearSolver;
+
+    // relative tolerance (overridden by the tolerance passed to fmi2SetupExperiment())
+    // and the configured one that is restored by fmi2Reset()
+    realtype relativeTolerance;
+    realtype defaultRelativeTolerance;
+    realtype startTime;
+
+    // time of the last communication point
+    realtype currentTime;
+
+    // let CVode step beyond the communication points and interpolate the states
+    int denseOutput;
+
+    // inputs have been set since the last communication point
+    int inputsChanged;
+
+    // linear solver and sparsity pattern of the Jacobian in compressed sparse column
+    // format as written to resources/cswrapper.mp by fmpy.cswrapper.add_cswrapper()
+    LinearSolver linearSolver;
+    size_t nnz;
+    sunindextype *colptrs;
+    sunindextype *rowvals;
+
+    // groups of columns of the Jacobian that don't share any rows and are evaluated together
+    // (the columns of group i are groupcols[groupptrs[i]] ... groupcols[groupptrs[i + 1] - 1])
+    size_t nGroups;
+    size_t *groupptrs;
+    size_t *groupcols;
+
+    // compute the Jacobian with fmi2GetDirectionalDerivative() instead of finite differences
+    int directionalDerivatives;
+    fmi2ValueReference *stateRefs;
+    fmi2ValueReference *derivativeRefs;
+
+    // seed or increments of the states of a column group (nx)
+    realtype *seed;
+
+    // time and continuous states last set in the model to skip redundant calls
+    realtype time;
+    realtype *states;
+    int timeValid;
+    int statesValid;
+
+    // number of evaluations of the derivatives and event indicators and of the calls
+    // that set the time and continuous states of the model
+    unsigned long nDerivatives;
+    unsigned long nEventIndicators;
+    unsigned long nSetTime;
+    unsigned long nSetContinuousStates;
+
+    // number of events and of the restarts of CVode they caused
+    unsigned long nEvents;
+    unsigned long nRestarts;
 
     /***************************************************
     Common Functions
@@ -102,15 +195,66 @@ typedef struct {
 
 } Model;
 
+/* Snapshot of the wrapper returned by fmi2GetFMUstate() */
+typedef struct {
+
+    fmi2FMUstate modelState;
+    fmi2EventInfo eventInfo;
+    realtype time;
+
+    // last step size of CVode to continue without estimating the initial step size
+    realtype step;
+
+    // continuous states (nx)
+    realtype *x;
+
+} WrapperState;
+
+/* Set the time and the continuous states of the model unless they are already set */
+static fmi2Status setTimeAndStates(Model *m, realtype t, const realtype *x) {
+
+    fmi2Status status = fmi2OK;
+
+    if (!m->timeValid || t != m->time) {
+
+        m->timeValid = 0;
+        m->nSetTime++;
+
+        status = m->fmi2SetTime(m->c, t);
+        if (status > fmi2Warning) return status;
+
+        m->time = t;
+        m->timeValid = 1;
+    }
+
+    if (m->nx > 0 && (!m->statesValid || memcmp(x, m->states, m->nx * sizeof(realtype)) != 0)) {
+
+        m->statesValid = 0;
+        m->nSetContinuousStates++;
+
+        status = m->fmi2SetContinuousStates(m->c, x, m->nx);
+        if (status > fmi2Warning) return status;
+
+        memcpy(m->states, x, m->nx * sizeof(realtype));
+        m->statesValid = 1;
+    }
+
+    return status;
+}
+
 static int f(realtype t, N_Vector y, N_Vector ydot, void *user_data) {
     
     Model *m = (Model *)user_data;
         
     if (m->nx > 0) {
-        fmi2Status status;
-        status = m->fmi2SetTime(m->c, t);
-        status = m->fmi2GetContinuousStates(m->c, NV_DATA_S(y), NV_LENGTH_S(y));
-        status = m->fmi2GetDerivatives(m->c, NV_DATA_S(ydot), NV_LENGTH_S(ydot));
+
+        m->nDerivatives++;
+
+        fmi2Status status = setTimeAndStates(m, t, NV_DATA_S(y));
+        if (status > fmi2Warning) return -1;
+
+        status = m->fmi2GetDerivatives(m->c, NV_DATA_S(ydot), m->nx);
+        if (status > fmi2Warning) return -1;
     }
         
     return 0;
@@ -120,14 +264,118 @@ static int f(realtype t, N_Vector y, N_Vector ydot, void *user_data) {
 static int g(realtype t, N_Vector y, realtype *gout, void *user_data) {
 
     Model *m = (Model *)user_data;
-    
-    fmi2Status status = m->fmi2SetTime(m->c, t);
 
-    if (m->nx > 0) {
-        status = m->fmi2SetContinuousStates(m->c, NV_DATA_S(y), NV_LENGTH_S(y));
-    }
+    m->nEventIndicators++;
+    
+    fmi2Status status = setTimeAndStates(m, t, NV_DATA_S(y));
+    if (status > fmi2Warning) return -1;
     
     status = m->fmi2GetEventIndicators(m->c, gout, m->nz);
+    if (status > fmi2Warning) return -1;
+
+    return 0;
+}
+
+/* Set the element k of the sparsity pattern in row i and column j of the Jacobian */
+static void setJacobianElement(SUNMatrix J, sunindextype i, sunindextype j, sunindextype k, realtype value) {
+
+    switch (SUNMatGetID(J)) {
+    case SUNMATRIX_DENSE:
+        SM_ELEMENT_D(J, i, j) = value;
+        break;
+    case SUNMATRIX_BAND:
+        SM_ELEMENT_B(J, i, j) = value;
+        break;
+#ifdef CSWRAPPER_KLU
+    case SUNMATRIX_SPARSE:
+        SM_DATA_S(J)[k] = value;
+        break;
+#endif
+    default:
+        break;
+    }
+}
+
+/* Compute the non-zero elements of the Jacobian with directional derivatives or forward
+   differences. The columns of a group don't share any rows, so they are evaluated together
+   with one directional derivative or one perturbation of the states. */
+static int jacobian(realtype t, N_Vector y, N_Vector fy, SUNMatrix J, void *user_data, N_Vector tmp1, N_Vector tmp2, N_Vector tmp3) {
+
+    Model *m = (Model *)user_data;
+
+    realtype *x  = NV_DATA_S(tmp1);
+    realtype *f0 = NV_DATA_S(tmp2);
+    realtype *f1 = NV_DATA_S(tmp3);
+
+    memcpy(x, NV_DATA_S(y), m->nx * sizeof(realtype));
+
+    fmi2Status status = setTimeAndStates(m, t, x);
+    if (status > fmi2Warning) return -1;
+
+    if (!m->directionalDerivatives) {
+        m->nDerivatives++;
+        status = m->fmi2GetDerivatives(m->c, f0, m->nx);
+        if (status > fmi2Warning) return -1;
+    }
+
+    if (SUNMatGetID(J) != SUNMATRIX_SPARSE) {
+        SUNMatZero(J);
+    }
+
+    for (size_t g = 0; g < m->nGroups; g++) {
+
+        const size_t *first = &m->groupcols[m->groupptrs[g]];
+        const size_t *last = &m->groupcols[m->groupptrs[g + 1]];
+
+        if (m->directionalDerivatives) {
+
+            for (const size_t *j = first; j < last; j++) {
+                m->seed[*j] = RCONST(1.0);
+            }
+
+            status = m->fmi2GetDirectionalDerivative(m->c, m->derivativeRefs, m->nx, m->stateRefs, m->nx, m->seed, f1);
+            if (status > fmi2Warning) return -1;
+
+        } else {
+
+            for (const size_t *j = first; j < last; j++) {
+                m->seed[*j] = SQRT_UROUND * fmax(fabs(x[*j]), RCONST(1.0));
+                x[*j] += m->seed[*j];
+            }
+
+            m->nDerivatives++;
+
+            status = setTimeAndStates(m, t, x);
+            if (status > fmi2Warning) return -1;
+
+            status = m->fmi2GetDerivatives(m->c, f1, m->nx);
+            if (status > fmi2Warning) return -1;
+        }
+
+        for (const size_t *j = first; j < last; j++) {
+
+            for (sunindextype k = m->colptrs[*j]; k < m->colptrs[*j + 1]; k++) {
+                const sunindextype i = m->rowvals[k];
+                const realtype value = m->directionalDerivatives ? f1[i] : (f1[i] - f0[i]) / m->seed[*j];
+                setJacobianElement(J, i, (sunindextype)*j, k, value);
+            }
+
+            x[*j] = NV_DATA_S(y)[*j];
+            m->seed[*j] = RCONST(0.0);
+        }
+    }
+
+#ifdef CSWRAPPER_KLU
+    if (SUNMatGetID(J) == SUNMATRIX_SPARSE) {
+        memcpy(SM_INDEXPTRS_S(J), m->colptrs, (m->nx + 1) * sizeof(sunindextype));
+        memcpy(SM_INDEXVALS_S(J), m->rowvals, m->nnz * sizeof(sunindextype));
+    }
+#endif
+
+    if (!m->directionalDerivatives) {
+        status = setTimeAndStates(m, t, NV_DATA_S(y));
+        if (status > fmi2Warning) return -1;
+    }
 
     return 0;
 }
@@ -140,6 +388,356 @@ static void ehfun(int error_code, const char *module, const char *function, char
 }
 
 
+/* Convert a file URI to a path and append filename */
+static void resourcePath(const char *uri, const char *filename, char *path, size_t size) {
+
+    const char *p = uri;
+
+    if (strncmp(p, "file://", 7) == 0) {
+        p += 7;
+        // skip the authority "localhost"
+        if (strncmp(p, "localhost", 9) == 0) {
+            p += 9;
+        }
+    } else if (strncmp(p, "file:", 5) == 0) {
+        p += 5;
+    }
+
+#ifdef _WIN32
+    // remove the slash before the drive letter
+    if (p[0] == '/' && p[1] != '\0' && p[2] == ':') {
+        p++;
+    }
+#endif
+
+    size_t i = 0;
+
+    // decode the percent-encoded characters
+    while (*p && i < size - 1) {
+        if (p[0] == '%' && p[1] && p[2]) {
+            char hex[3] = { p[1], p[2], '\0' };
+            path[i++] = (char)strtol(hex, NULL, 16);
+            p += 3;
+        } else {
+            path[i++] = *p++;
+        }
+    }
+
+    if (i > 0 && path[i - 1] != '/' && i < size - 1) {
+        path[i++] = '/';
+    }
+
+    path[i] = '\0';
+
+    strncat(path, filename, size - i - 1);
+}
+
+/* Read an array of unsigned integers from a map */
+static int readArray(mpack_node_t map, const char *key, size_t size, size_t elementSize, void **array) {
+
+    mpack_node_t node = mpack_node_map_cstr(map, key);
+
+    if (mpack_node_array_length(node) != size) {
+        return 0;
+    }
+
+    *array = calloc(size > 0 ? size : 1, elementSize);
+
+    if (!*array) {
+        return 0;
+    }
+
+    for (size_t i = 0; i < size; i++) {
+
+        const uint64_t value = mpack_node_u64(mpack_node_array_at(node, i));
+
+        switch (elementSize) {
+        case sizeof(uint32_t): ((uint32_t *)*array)[i] = (uint32_t)value; break;
+        case sizeof(uint64_t): ((uint64_t *)*array)[i] = value; break;
+        default: return 0;
+        }
+    }
+
+    return 1;
+}
+
+/* Check the sparsity pattern and group the columns by their colors */
+static int initPattern(Model *m, const size_t *colors) {
+
+    if (m->colptrs[0] != 0 || (size_t)m->colptrs[m->nx] != m->nnz) {
+        return 0;
+    }
+
+    for (size_t j = 0; j < m->nx; j++) {
+        if (m->colptrs[j] > m->colptrs[j + 1]) {
+            return 0;
+        }
+    }
+
+    for (size_t k = 0; k < m->nnz; k++) {
+        if (m->rowvals[k] < 0 || (size_t)m->rowvals[k] >= m->nx) {
+            return 0;
+        }
+    }
+
+    // without colors every column is a group of its own
+    m->nGroups = 0;
+
+    for (size_t j = 0; j < m->nx; j++) {
+        const size_t color = colors ? colors[j] : j;
+        if (color >= m->nx) {
+            return 0;
+        }
+        if (color + 1 > m->nGroups) {
+            m->nGroups = color + 1;
+        }
+    }
+
+    m->groupptrs = calloc(m->nGroups + 1, sizeof(size_t));
+    m->groupcols = calloc(m->nx > 0 ? m->nx : 1, sizeof(size_t));
+    m->seed = calloc(m->nx > 0 ? m->nx : 1, sizeof(realtype));
+
+    size_t *mark = calloc(m->nx > 0 ? m->nx : 1, sizeof(size_t));
+
+    if (!m->groupptrs || !m->groupcols || !m->seed || !mark) {
+        free(mark);
+        return 0;
+    }
+
+    // counting sort of the columns by color
+    for (size_t j = 0; j < m->nx; j++) {
+        m->groupptrs[(colors ? colors[j] : j) + 1]++;
+    }
+
+    for (size_t g = 0; g < m->nGroups; g++) {
+        m->groupptrs[g + 1] += m->groupptrs[g];
+    }
+
+    for (size_t j = 0; j < m->nx; j++) {
+        const size_t color = colors ? colors[j] : j;
+        m->groupcols[m->groupptrs[color] + mark[color]++] = j;
+    }
+
+    // the columns of a group must not share any rows
+    memset(mark, 0, m->nx * sizeof(size_t));
+
+    for (size_t g = 0; g < m->nGroups; g++) {
+        for (size_t l = m->groupptrs[g]; l < m->groupptrs[g + 1]; l++) {
+            const size_t j = m->groupcols[l];
+            for (sunindextype k = m->colptrs[j]; k < m->colptrs[j + 1]; k++) {
+                if (mark[m->rowvals[k]] == g + 1) {
+                    free(mark);
+                    return 0;
+                }
+                mark[m->rowvals[k]] = g + 1;
+            }
+        }
+    }
+
+    free(mark);
+
+    return 1;
+}
+
+/* Read the options from resources/cswrapper.mp. The defaults are used if the file doesn't exist. */
+static int readConfig(Model *m, fmi2String fmuResourceLocation) {
+
+    if (!fmuResourceLocation) {
+        return 1;
+    }
+
+    char path[4096] = "";
+
+    resourcePath(fmuResourceLocation, "cswrapper.mp", path, sizeof(path));
+
+    FILE *file = fopen(path, "rb");
+
+    if (!file) {
+        return 1;
+    }
+
+    fclose(file);
+
+    mpack_tree_t tree;
+
+    mpack_tree_init_filename(&tree, path, 0);
+    mpack_tree_parse(&tree);
+
+    mpack_node_t root = mpack_tree_root(&tree);
+
+    int success = 1;
+
+    size_t *colors = NULL;
+
+    if (mpack_node_map_contains_cstr(root, "method")) {
+        const char *methods[] = { "bdf", "adams" };
+        m->method = (Method)mpack_node_enum(mpack_node_map_cstr(root, "method"), methods, 2);
+    }
+
+    // BDF is meant for stiff systems and uses Newton's method, Adams for non-stiff systems
+    // and uses the fixed point iteration that doesn't need a Jacobian
+    m->nonlinearSolver = m->method == Adams ? FixedPoint : Newton;
+
+    if (mpack_node_map_contains_cstr(root, "nonlinearSolver")) {
+        const char *nonlinearSolvers[] = { "newton", "fixedpoint" };
+        m->nonlinearSolver = (NonlinearSolver)mpack_node_enum(mpack_node_map_cstr(root, "nonlinearSolver"), nonlinearSolvers, 2);
+    }
+
+    if (mpack_node_map_contains_cstr(root, "denseOutput")) {
+        m->denseOutput = mpack_node_bool(mpack_node_map_cstr(root, "denseOutput"));
+    }
+
+    if (mpack_node_map_contains_cstr(root, "relativeTolerance")) {
+        m->relativeTolerance = mpack_node_double(mpack_node_map_cstr(root, "relativeTolerance"));
+        success = m->relativeTolerance > 0;
+    }
+
+    if (mpack_node_map_contains_cstr(root, "linearSolver")) {
+        const char *linearSolvers[] = { "dense", "sparse" };
+        m->linearSolver = (LinearSolver)mpack_node_enum(mpack_node_map_cstr(root, "linearSolver"), linearSolvers, 2);
+    }
+
+    if (mpack_node_map_contains_cstr(root, "directionalDerivatives")) {
+        m->directionalDerivatives = mpack_node_bool(mpack_node_map_cstr(root, "directionalDerivatives"));
+    }
+
+    if (mpack_node_map_contains_cstr(root, "colptrs")) {
+
+        m->nnz = mpack_node_array_length(mpack_node_map_cstr(root, "rowvals"));
+
+        success = readArray(root, "colptrs", m->nx + 1, sizeof(sunindextype), (void **)&m->colptrs) &&
+                  readArray(root, "rowvals", m->nnz, sizeof(sunindextype), (void **)&m->rowvals);
+
+        if (success && mpack_node_map_contains_cstr(root, "colors")) {
+            success = readArray(root, "colors", m->nx, sizeof(size_t), (void **)&colors);
+        }
+
+        success = success && initPattern(m, colors);
+
+    } else if (success && m->nx > 0 && (m->linearSolver == Sparse || m->directionalDerivatives)) {
+        // the sparse solver and the directional derivatives require the sparsity pattern
+        success = 0;
+    }
+
+    if (success && m->directionalDerivatives) {
+        success = readArray(root, "states", m->nx, sizeof(fmi2ValueReference), (void **)&m->stateRefs) &&
+                  readArray(root, "derivatives", m->nx, sizeof(fmi2ValueReference), (void **)&m->derivativeRefs);
+    }
+
+    free(colors);
+
+    return mpack_tree_destroy(&tree) == mpack_ok && success;
+}
+
+/* Create the matrix and linear solver for the Newton iteration */
+static int createLinearSolver(Model *m) {
+
+    const sunindextype n = m->nx > 0 ? (sunindextype)m->nx : 1;
+
+    if (m->nx > 0 && m->linearSolver == Sparse) {
+
+#ifdef CSWRAPPER_KLU
+        m->A = SUNSparseMatrix(n, n, (sunindextype)m->nnz, CSC_MAT);
+        if (!m->A) return 0;
+
+        m->LS = SUNLinSol_KLU(m->x, m->A);
+        if (!m->LS) return 0;
+#else
+        // without KLU the sparsity pattern determines the bandwidths of a band matrix
+        sunindextype mu = 0, ml = 0;
+
+        for (size_t j = 0; j < m->nx; j++) {
+            for (sunindextype k = m->colptrs[j]; k < m->colptrs[j + 1]; k++) {
+                const sunindextype i = m->rowvals[k];
+                if ((sunindextype)j - i > mu) mu = (sunindextype)j - i;
+                if (i - (sunindextype)j > ml) ml = i - (sunindextype)j;
+            }
+        }
+
+        // the band LU factorization stores 2 * ml + mu + 1 diagonals and is slower than the dense
+        // one for patterns that are not banded
+        if (2 * ml + mu + 1 < n) {
+
+            m->A = SUNBandMatrix(n, mu, ml);
+            if (!m->A) return 0;
+
+            m->LS = SUNLinSol_Band(m->x, m->A);
+            if (!m->LS) return 0;
+
+        } else {
+
+            m->logger(m, m->instanceName, fmi2Warning, "logWarning",
+                "The sparsity pattern has a bandwidth of %ld (upper) and %ld (lower), so the dense linear solver is used. Build the wrapper with CSWRAPPER_KLU to use the sparse solver.",
+                (long)mu, (long)ml);
+
+            m->A = SUNDenseMatrix(n, n);
+            if (!m->A) return 0;
+
+            m->LS = SUNLinSol_Dense(m->x, m->A);
+            if (!m->LS) return 0;
+        }
+#endif
+    } else {
+
+        m->A = SUNDenseMatrix(n, n);
+        if (!m->A) return 0;
+
+        m->LS = SUNLinSol_Dense(m->x, m->A);
+        if (!m->LS) return 0;
+    }
+
+    if (CVodeSetLinearSolver(m->cvode_mem, m->LS, m->A) != CV_SUCCESS) return 0;
+
+    // CVode can only approximate dense and band Jacobians by difference quotients
+    if (m->nx > 0 && (m->directionalDerivatives || SUNMatGetID(m->A) == SUNMATRIX_SPARSE)) {
+        return CVodeSetJacFn(m->cvode_mem, jacobian) == CV_SUCCESS;
+    }
+
+    return 1;
+}
+
+/* Re-initialize CVode at time t with the states m->x and the last step size as initial step */
+static int restartSolver(Model *m, realtype t) {
+
+    realtype hlast;
+
+    m->nRestarts++;
+
+    if (CVodeGetLastStep(m->cvode_mem, &hlast) != CV_SUCCESS) return 0;
+    if (CVodeReInit(m->cvode_mem, t, m->x) != CV_SUCCESS) return 0;
+
+    return CVodeSetInitStep(m->cvode_mem, hlast) == CV_SUCCESS;
+}
+
+/* Disable a stop time that has not been reached (SUNDIALS 5 has no function to clear it) */
+static int clearStopTime(Model *m) {
+    return CVodeSetStopTime(m->cvode_mem, BIG_REAL) == CV_SUCCESS;
+}
+
+/* Set the relative tolerance and the absolute tolerances scaled by the nominal values of the states */
+static int setTolerances(Model *m) {
+
+    realtype *abstol = NV_DATA_S(m->abstol);
+
+    if (m->nx > 0) {
+
+        fmi2Status status = m->fmi2GetNominalsOfContinuousStates(m->c, abstol, m->nx);
+
+        if (status > fmi2Warning) {
+            return 0;
+        }
+
+        for (size_t i = 0; i < m->nx; i++) {
+            abstol[i] = m->relativeTolerance * fabs(abstol[i]);
+        }
+    } else {
+        abstol[0] = m->relativeTolerance;
+    }
+
+    return CVodeSVtolerances(m->cvode_mem, m->relativeTolerance, m->abstol) == CV_SUCCESS;
+}
+
+
 /***************************************************
 Types for Common Functions
 ****************************************************/
@@ -152,7 +750,8 @@ const char* fmi2GetVersion(void) { return fmi2Version; }
 fmi2Status fmi2SetDebugLogging(fmi2Component c, fmi2Boolean loggingOn, size_t nCategories, const fmi2String categories[]) {
     if (!c) return fmi2Error;
     Model *m = (Model *)c;
-    return m->fmi2SetDebugLogging(c, loggingOn, nCategories, categories);
+    m->loggingOn = loggingOn;
+    return m->fmi2SetDebugLogging(m->c, loggingOn, nCategories, categories);
 }
 
 
@@ -188,6 +787,7 @@ fmi2Component fmi2Instantiate(fmi2String instanceName,
 
 	m->logger = functions->logger;
 	m->instanceName = strdup(instanceName);
+    m->loggingOn = loggingOn;
     
 #ifdef _WIN32
 	char path[MAX_PATH];
@@ -293,31 +893,45 @@ fmi2Component fmi2Instantiate(fmi2String instanceName,
     GET(fmi2GetContinuousStates)
     GET(fmi2GetNominalsOfContinuousStates)
 
+    m->relativeTolerance = RTOL;
+    m->denseOutput = 1;
+
+    if (!readConfig(m, fmuResourceLocation)) {
+        functions->logger(NULL, instanceName, fmi2Error, "logError", "Failed to read the options from %s/cswrapper.mp.", fmuResourceLocation);
+        return NULL;
+    }
+
+    m->defaultRelativeTolerance = m->relativeTolerance;
+
     m->c = m->fmi2Instantiate(instanceName, fmi2ModelExchange, fmuGUID, fmuResourceLocation, functions, visible, loggingOn); 
 	ASSERT_NOT_NULL(m->c)
     
+    m->states = calloc(m->nx > 0 ? m->nx : 1, sizeof(realtype));
+    ASSERT_NOT_NULL(m->states)
+
     if (m->nx > 0) {
         m->x = N_VNew_Serial(m->nx);
         m->abstol = N_VNew_Serial(m->nx);
         for (size_t i = 0; i < m->nx; i++) {
-            NV_DATA_S(m->abstol)[i] = RTOL;
+            NV_DATA_S(m->x)[i] = 0;
+            NV_DATA_S(m->abstol)[i] = m->relativeTolerance;
         }
-        m->A = SUNDenseMatrix(m->nx, m->nx);
     } else  {
         m->x = N_VNew_Serial(1);
         m->abstol = N_VNew_Serial(1);
-        NV_DATA_S(m->abstol)[0] = RTOL;
-        m->A = SUNDenseMatrix(1, 1);
+        NV_DATA_S(m->x)[0] = 0;
+        NV_DATA_S(m->abstol)[0] = m->relativeTolerance;
     }
     
-    m->cvode_mem = CVodeCreate(CV_BDF);
+    m->cvode_mem = CVodeCreate(m->method == Adams ? CV_ADAMS : CV_BDF);
     
 	int flag;
 		
 	flag = CVodeInit(m->cvode_mem, f, 0, m->x);
 	ASSERT_CV_SUCCESS(flag)
 
-    flag = CVodeSVtolerances(m->cvode_mem, RTOL, m->abstol);
+    // the absolute tolerances are scaled by the nominal values in fmi2ExitInitializationMode()
+    flag = CVodeSVtolerances(m->cvode_mem, m->relativeTolerance, m->abstol);
 	ASSERT_CV_SUCCESS(flag)
 
     if (m->nz > 0) {
@@ -325,10 +939,18 @@ fmi2Component fmi2Instantiate(fmi2String instanceName,
 		ASSERT_CV_SUCCESS(flag)
     }
     
-    m->LS = SUNLinSol_Dense(m->x, m->A);
+    if (m->nonlinearSolver == FixedPoint) {
 
-    flag = CVodeSetLinearSolver(m->cvode_mem, m->LS, m->A);
-	ASSERT_CV_SUCCESS(flag)
+        m->NLS = SUNNonlinSol_FixedPoint(m->x, 0);
+        ASSERT_NOT_NULL(m->NLS)
+
+        flag = CVodeSetNonlinearSolver(m->cvode_mem, m->NLS);
+        ASSERT_CV_SUCCESS(flag)
+
+    } else if (!createLinearSolver(m)) {
+        functions->logger(NULL, instanceName, fmi2Error, "logError", "Failed to create the linear solver.");
+        return NULL;
+    }
 
 	flag = CVodeSetNoInactiveRootWarn(m->cvode_mem);
 	ASSERT_CV_SUCCESS(flag)
@@ -368,6 +990,18 @@ void fmi2FreeInstance(fmi2Component c) {
 	/* Free the matrix memory */
 	SUNMatDestroy(m->A);
 
+	/* Free the nonlinear solver memory */
+	SUNNonlinSolFree(m->NLS);
+
+	free(m->colptrs);
+	free(m->rowvals);
+	free(m->groupptrs);
+	free(m->groupcols);
+	free(m->stateRefs);
+	free(m->derivativeRefs);
+	free(m->seed);
+	free(m->states);
+
     free(m);
 }
 
@@ -380,6 +1014,17 @@ fmi2Status fmi2SetupExperiment(fmi2Component c,
                                fmi2Real stopTime) {
     if (!c) return fmi2Error;
     Model *m = (Model *)c;
+
+    if (toleranceDefined) {
+        if (tolerance <= 0) {
+            m->logger(m, m->instanceName, fmi2Error, "logError", "Argument tolerance must be greater than zero.");
+            return fmi2Error;
+        }
+        m->relativeTolerance = tolerance;
+    }
+
+    m->startTime = startTime;
+
     return m->fmi2SetupExperiment(m->c, toleranceDefined, tolerance, startTime, stopTimeDefined, stopTime);
 }
 
@@ -403,20 +1048,77 @@ fmi2Status fmi2ExitInitializationMode(fmi2Component c) {
     status = m->fmi2EnterContinuousTimeMode(m->c);
     if (status > fmi2Warning) { return status; }
 
+    // the nominal values and initial states are known after the initialization
+    if (!setTolerances(m)) { return fmi2Error; }
+
+    m->timeValid = 0;
+    m->statesValid = 0;
+
+    if (m->nx > 0) {
+        status = m->fmi2GetContinuousStates(m->c, NV_DATA_S(m->x), m->nx);
+        if (status > fmi2Warning) { return status; }
+    }
+
+    if (CVodeReInit(m->cvode_mem, m->startTime, m->x) != CV_SUCCESS) { return fmi2Error; }
+
+    m->currentTime = m->startTime;
+    m->inputsChanged = 0;
+
     return status;
 }
 
 fmi2Status fmi2Terminate(fmi2Component c) {
     if (!c) return fmi2Error;
     Model *m = (Model *)c;
+
+    if (m->loggingOn) {
+        m->logger(m, m->instanceName, fmi2OK, "logStatusInfo",
+            "%lu evaluations of the derivatives and %lu of the event indicators with %lu calls of fmi2SetTime() and %lu of fmi2SetContinuousStates().",
+            m->nDerivatives, m->nEventIndicators, m->nSetTime, m->nSetContinuousStates);
+        m->logger(m, m->instanceName, fmi2OK, "logStatusInfo", "%lu events with %lu restarts of CVode.", m->nEvents, m->nRestarts);
+    }
+
     return m->fmi2Terminate(m->c);
 }
 
 fmi2Status fmi2Reset(fmi2Component c) {
     if (!c) return fmi2Error;
     Model *m = (Model *)c;
-	// TODO: reset solver
-    return m->fmi2Reset(m->c);
+
+    fmi2Status status = m->fmi2Reset(m->c);
+    if (status > fmi2Warning) return status;
+
+    // reset the wrapper to the state after fmi2Instantiate() and re-initialize CVode in place,
+    // so the vectors, matrix and solvers are reused
+    memset(&m->eventInfo, 0, sizeof(fmi2EventInfo));
+
+    m->relativeTolerance = m->defaultRelativeTolerance;
+    m->startTime = 0;
+    m->currentTime = 0;
+
+    m->timeValid = 0;
+    m->statesValid = 0;
+    m->inputsChanged = 0;
+
+    m->nDerivatives = 0;
+    m->nEventIndicators = 0;
+    m->nSetTime = 0;
+    m->nSetContinuousStates = 0;
+    m->nEvents = 0;
+    m->nRestarts = 0;
+
+    N_VConst(0, m->x);
+
+    if (!clearStopTime(m)) return fmi2Error;
+    if (CVodeReInit(m->cvode_mem, 0, m->x) != CV_SUCCESS) return fmi2Error;
+    if (CVodeSetInitStep(m->cvode_mem, 0) != CV_SUCCESS) return fmi2Error;
+
+    // the absolute tolerances are scaled by the nominal values in fmi2ExitInitializationMode()
+    N_VConst(m->relativeTolerance, m->abstol);
+
+    if (CVodeSVtolerances(m->cvode_mem, m->relativeTolerance, m->abstol) != CV_SUCCESS) return fmi2Error;
+
+    return status;
 }
 
 /* Getting and setting variable values */
@@ -444,53 +1146,255 @@ fmi2Status fmi2GetString(fmi2Component c, const fmi2ValueReference vr[], size_t
     return m->fmi2GetString(m->c, vr, nvr, value);
 }
 
+/* compare the new values with the current ones, so that setting unchanged inputs does not restart the solver */
+#define VALUES_CHANGED(T) \
+static int valuesChanged ## T(Model *m, const fmi2ValueReference vr[], size_t nvr, const fmi2 ## T value[]) { \
+    if (nvr == 0) return 0; \
+    fmi2 ## T *current = calloc(nvr, sizeof(fmi2 ## T)); \
+    int changed = !current || m->fmi2Get ## T(m->c, vr, nvr, current) > fmi2Warning; \
+    for (size_t i = 0; !changed && i < nvr; i++) { \
+        changed = current[i] != value[i]; \
+    } \
+    free(current); \
+    return changed; \
+}
+
+VALUES_CHANGED(Real)
+VALUES_CHANGED(Integer)
+VALUES_CHANGED(Boolean)
+
+static int valuesChangedString(Model *m, const fmi2ValueReference vr[], size_t nvr, const fmi2String value[]) {
+    if (nvr == 0) return 0;
+    fmi2String *current = calloc(nvr, sizeof(fmi2String));
+    int changed = !current || m->fmi2GetString(m->c, vr, nvr, current) > fmi2Warning;
+    for (size_t i = 0; !changed && i < nvr; i++) {
+        if (!current[i] || !value[i]) {
+            changed = current[i] != value[i];
+        } else {
+            changed = strcmp(current[i], value[i]) != 0;
+        }
+    }
+    free(current);
+    return changed;
+}
+
 fmi2Status fmi2SetReal(fmi2Component c, const fmi2ValueReference vr[], size_t nvr, const fmi2Real    value[]) {
     if (!c) return fmi2Error;
     Model *m = (Model *)c;
+    if (!m->inputsChanged && valuesChangedReal(m, vr, nvr, value)) m->inputsChanged = 1;
     return m->fmi2SetReal(m->c, vr, nvr, value);
 }
 
 fmi2Status fmi2SetInteger(fmi2Component c, const fmi2ValueReference vr[], size_t nvr, const fmi2Integer value[]) {
     if (!c) return fmi2Error;
     Model *m = (Model *)c;
+    if (!m->inputsChanged && valuesChangedInteger(m, vr, nvr, value)) m->inputsChanged = 1;
     return m->fmi2SetInteger(m->c, vr, nvr, value);
 }
 
 fmi2Status fmi2SetBoolean(fmi2Component c, const fmi2ValueReference vr[], size_t nvr, const fmi2Boolean value[]) {
     if (!c) return fmi2Error;
     Model *m = (Model *)c;
+    if (!m->inputsChanged && valuesChangedBoolean(m, vr, nvr, value)) m->inputsChanged = 1;
     return m->fmi2SetBoolean(m->c, vr, nvr, value);
 }
 
 fmi2Status fmi2SetString(fmi2Component c, const fmi2ValueReference vr[], size_t nvr, const fmi2String  value[]) {
     if (!c) return fmi2Error;
     Model *m = (Model *)c;
+    if (!m->inputsChanged && valuesChangedString(m, vr, nvr, value)) m->inputsChanged = 1;
     return m->fmi2SetString(m->c, vr, nvr, value);
 }
 
 /* Getting and setting the internal FMU state */
+
+/* size of the serialized wrapper state without the state of the model */
+#define SERIALIZED_HEADER_SIZE(m) (sizeof(size_t) + sizeof(fmi2EventInfo) + (2 + (m)->nx) * sizeof(realtype))
+
+static WrapperState* allocateWrapperState(Model *m) {
+
+    WrapperState *state = calloc(1, sizeof(WrapperState));
+
+    if (state) {
+        state->x = calloc(m->nx > 0 ? m->nx : 1, sizeof(realtype));
+    }
+
+    if (!state || !state->x) {
+        free(state);
+        return NULL;
+    }
+
+    return state;
+}
+
 fmi2Status fmi2GetFMUstate(fmi2Component c, fmi2FMUstate* FMUstate) {
-    return fmi2Error;
+    if (!c || !FMUstate) return fmi2Error;
+    Model *m = (Model *)c;
+
+    WrapperState *state = (WrapperState *)*FMUstate;
+
+    if (!state) {
+        state = allocateWrapperState(m);
+        if (!state) return fmi2Error;
+    }
+
+    // the model updates its state if it already exists
+    fmi2Status status = m->fmi2GetFMUstate(m->c, &state->modelState);
+
+    if (status > fmi2Warning) {
+        if (!*FMUstate) {
+            free(state->x);
+            free(state);
+        }
+        return status;
+    }
+
+    state->eventInfo = m->eventInfo;
+    state->time = m->currentTime;
+    state->step = 0;
+
+    CVodeGetLastStep(m->cvode_mem, &state->step);
+
+    memcpy(state->x, NV_DATA_S(m->x), m->nx * sizeof(realtype));
+
+    *FMUstate = state;
+
+    return status;
 }
 
 fmi2Status fmi2SetFMUstate(fmi2Component c, fmi2FMUstate  FMUstate) {
-    return fmi2Error;
+    if (!c || !FMUstate) return fmi2Error;
+    Model *m = (Model *)c;
+
+    WrapperState *state = (WrapperState *)FMUstate;
+
+    fmi2Status status = m->fmi2SetFMUstate(m->c, state->modelState);
+    if (status > fmi2Warning) return status;
+
+    m->eventInfo = state->eventInfo;
+    m->currentTime = state->time;
+    m->inputsChanged = 0;
+
+    memcpy(NV_DATA_S(m->x), state->x, m->nx * sizeof(realtype));
+
+    m->timeValid = 0;
+    m->statesValid = 0;
+
+    // CVode has no API to restore its history, so it is restarted with the last step size
+    if (!clearStopTime(m)) return fmi2Error;
+    if (CVodeReInit(m->cvode_mem, state->time, m->x) != CV_SUCCESS) return fmi2Error;
+    if (CVodeSetInitStep(m->cvode_mem, state->step) != CV_SUCCESS) return fmi2Error;
+
+    return status;
 }
 
 fmi2Status fmi2FreeFMUstate(fmi2Component c, fmi2FMUstate* FMUstate) {
-    return fmi2Error;
+    if (!c || !FMUstate) return fmi2Error;
+    Model *m = (Model *)c;
+
+    WrapperState *state = (WrapperState *)*FMUstate;
+
+    if (!state) return fmi2OK;
+
+    fmi2Status status = m->fmi2FreeFMUstate(m->c, &state->modelState);
+
+    free(state->x);
+    free(state);
+
+    *FMUstate = NULL;
+
+    return status;
 }
 
 fmi2Status fmi2SerializedFMUstateSize(fmi2Component c, fmi2FMUstate  FMUstate, size_t* size) {
-    return fmi2Error;
+    if (!c || !FMUstate || !size) return fmi2Error;
+    Model *m = (Model *)c;
+
+    WrapperState *state = (WrapperState *)FMUstate;
+
+    size_t modelSize = 0;
+
+    fmi2Status status = m->fmi2SerializedFMUstateSize(m->c, state->modelState, &modelSize);
+    if (status > fmi2Warning) return status;
+
+    *size = SERIALIZED_HEADER_SIZE(m) + modelSize;
+
+    return status;
 }
 
 fmi2Status fmi2SerializeFMUstate(fmi2Component c, fmi2FMUstate  FMUstate, fmi2Byte serializedState[], size_t size) {
-    return fmi2Error;
+    if (!c || !FMUstate || !serializedState) return fmi2Error;
+    Model *m = (Model *)c;
+
+    WrapperState *state = (WrapperState *)FMUstate;
+
+    if (size < SERIALIZED_HEADER_SIZE(m)) return fmi2Error;
+
+    // nx, eventInfo, time, step, x, followed by the serialized state of the model
+    fmi2Byte *p = serializedState;
+
+    memcpy(p, &m->nx, sizeof(size_t));
+    p += sizeof(size_t);
+
+    memcpy(p, &state->eventInfo, sizeof(fmi2EventInfo));
+    p += sizeof(fmi2EventInfo);
+
+    memcpy(p, &state->time, sizeof(realtype));
+    p += sizeof(realtype);
+
+    memcpy(p, &state->step, sizeof(realtype));
+    p += sizeof(realtype);
+
+    memcpy(p, state->x, m->nx * sizeof(realtype));
+    p += m->nx * sizeof(realtype);
+
+    return m->fmi2SerializeFMUstate(m->c, state->modelState, p, size - SERIALIZED_HEADER_SIZE(m));
 }
 
 fmi2Status fmi2DeSerializeFMUstate(fmi2Component c, const fmi2Byte serializedState[], size_t size, fmi2FMUstate* FMUstate) {
-    return fmi2Error;
+    if (!c || !serializedState || !FMUstate) return fmi2Error;
+    Model *m = (Model *)c;
+
+    size_t nx;
+
+    if (size < SERIALIZED_HEADER_SIZE(m)) return fmi2Error;
+
+    const fmi2Byte *p = serializedState;
+
+    memcpy(&nx, p, sizeof(size_t));
+    p += sizeof(size_t);
+
+    if (nx != m->nx) {
+        m->logger(m, m->instanceName, fmi2Error, "logError", "The serialized FMU state has %zu continuous states but the model has %zu.", nx, m->nx);
+        return fmi2Error;
+    }
+
+    WrapperState *state = allocateWrapperState(m);
+    if (!state) return fmi2Error;
+
+    memcpy(&state->eventInfo, p, sizeof(fmi2EventInfo));
+    p += sizeof(fmi2EventInfo);
+
+    memcpy(&state->time, p, sizeof(realtype));
+    p += sizeof(realtype);
+
+    memcpy(&state->step, p, sizeof(realtype));
+    p += sizeof(realtype);
+
+    memcpy(state->x, p, m->nx * sizeof(realtype));
+    p += m->nx * sizeof(realtype);
+
+    fmi2Status status = m->fmi2DeSerializeFMUstate(m->c, p, size - SERIALIZED_HEADER_SIZE(m), &state->modelState);
+
+    if (status > fmi2Warning) {
+        free(state->x);
+        free(state);
+        return status;
+    }
+
+    *FMUstate = state;
+
+    return status;
 }
 
 /* Getting partial derivatives */
@@ -532,7 +1436,7 @@ fmi2Status fmi2DoStep(fmi2Component c,
     if (!c) return fmi2Error;
     Model *m = (Model *)c;
     
-    fmi2Status status;
+    fmi2Status status = fmi2OK;
     
     realtype tret = currentCommunicationPoint;
     realtype tNext = currentCommunicationPoint + communicationStepSize;
@@ -543,6 +1447,20 @@ fmi2Status fmi2DoStep(fmi2Component c,
         if (status > fmi2Warning) return status;
     }
     
+    m->currentTime = tret;
+
+    realtype tcur;
+
+    // with dense output CVode may have stepped beyond the communication point with the previous inputs
+    if (m->inputsChanged) {
+
+        m->inputsChanged = 0;
+
+        if (CVodeGetCurrentTime(m->cvode_mem, &tcur) != CV_SUCCESS) return fmi2Error;
+
+        if (tcur > tret + epsilon && !restartSolver(m, tret)) return fmi2Error;
+    }
+
     while (tret + epsilon < tNext) {
         
         realtype tout = tNext;
@@ -550,6 +1468,12 @@ fmi2Status fmi2DoStep(fmi2Component c,
         if (m->eventInfo.nextEventTimeDefined && m->eventInfo.nextEventTime < tNext) {
             tout = m->eventInfo.nextEventTime;
         }
+
+        // don't step across time events and, without dense output, communication points,
+        // so the solver can continue after them
+        if (tout < tNext || !m->denseOutput) {
+            if (CVodeSetStopTime(m->cvode_mem, tout) != CV_SUCCESS) return fmi2Error;
+        }
     
         int flag = CVode(m->cvode_mem, tout, m->x, &tret, CV_NORMAL);
         
@@ -558,13 +1482,10 @@ fmi2Status fmi2DoStep(fmi2Component c,
             return fmi2Error;
         }
         
-        status = m->fmi2SetTime(m->c, tret);
-        if (status > fmi2Warning) return status;
+        m->currentTime = tret;
 
-        if (m->nx > 0) {
-            status = m->fmi2SetContinuousStates(m->c, NV_DATA_S(m->x), NV_LENGTH_S(m->x));
-            if (status > fmi2Warning) return status;
-        }
+        status = setTimeAndStates(m, tret, NV_DATA_S(m->x));
+        if (status > fmi2Warning) return status;
         
         fmi2Boolean enterEventMode, terminateSimulation;
         
@@ -575,24 +1496,43 @@ fmi2Status fmi2DoStep(fmi2Component c,
         
         if (flag == CV_ROOT_RETURN || enterEventMode || (m->eventInfo.nextEventTimeDefined && m->eventInfo.nextEventTime == tret)) {
 
-            m->fmi2EnterEventMode(m->c);
+            m->nEvents++;
+
+            status = m->fmi2EnterEventMode(m->c);
             if (status > fmi2Warning) return status;
 
+            // the event iteration may change the continuous states
+            m->statesValid = 0;
+
             do {
-                m->fmi2NewDiscreteStates(m->c, &m->eventInfo);
+                status = m->fmi2NewDiscreteStates(m->c, &m->eventInfo);
                 if (status > fmi2Warning) return status;
             } while (m->eventInfo.newDiscreteStatesNeeded && !m->eventInfo.terminateSimulation);
 
-            m->fmi2EnterContinuousTimeMode(m->c);
+            status = m->fmi2EnterContinuousTimeMode(m->c);
             if (status > fmi2Warning) return status;
 
             if (m->nx > 0 && m->eventInfo.valuesOfContinuousStatesChanged) {
                 status = m->fmi2GetContinuousStates(m->c, NV_DATA_S(m->x), NV_LENGTH_S(m->x));
                 if (status > fmi2Warning) return status;
             }
+
+            if (m->eventInfo.nominalsOfContinuousStatesChanged && !setTolerances(m)) {
+                return fmi2Error;
+            }
             
-            flag = CVodeReInit(m->cvode_mem, tret, m->x);
+            flag = CVodeGetCurrentTime(m->cvode_mem, &tcur);
             if (flag < 0) return fmi2Error;
+
+            // CVode keeps its order and history if it has not stepped beyond the event
+            // (e.g. a time event or a step event at the end of an internal step) and the
+            // states didn't jump. Otherwise it restarts with the last step size.
+            // With event indicators it always restarts, because the new discrete states
+            // may change the event indicators and CVode's root finding would compare
+            // them against the values from before the event.
+            if (m->nz > 0 || m->eventInfo.valuesOfContinuousStatesChanged || m->eventInfo.nominalsOfContinuousStatesChanged || fabs(tcur - tret) > epsilon) {
+                if (!restartSolver(m, tret)) return fmi2Error;
+            }
         }
         
     }
@@ -624,3 +1564,102 @@ fmi2Status fmi2GetBooleanStatus(fmi2Component c, const fmi2StatusKind s, fmi2Boo
 fmi2Status fmi2GetStringStatus(fmi2Component c, const fmi2StatusKind s, fmi2String*  value) {
     return fmi2Error;
 }
+
+
+/***************************************************
+Ensemble runs
+****************************************************/
+
+typedef struct {
+
+    Model **instances;
+    fmi2Real currentCommunicationPoint;
+    fmi2Real communicationStepSize;
+    size_t nSteps;
+    const fmi2ValueReference *vr;
+    size_t nvr;
+    fmi2Real *values;
+    fmi2Status *status;
+
+} Ensemble;
+
+/* Advance one instance by all steps, so its solver state stays in the cache of one worker */
+static void doStepsTask(void *context, size_t index) {
+
+    Ensemble *e = (Ensemble *)context;
+    Model *m = e->instances[index];
+
+    fmi2Status status = fmi2OK;
+
+    for (size_t k = 0; k < e->nSteps; k++) {
+
+        const fmi2Real t = e->currentCommunicationPoint + k * e->communicationStepSize;
+
+        fmi2Status s = fmi2DoStep(m, t, e->communicationStepSize, fmi2True);
+        if (s > status) status = s;
+        if (status > fmi2Warning) break;
+
+        if (e->nvr > 0) {
+            s = fmi2GetReal(m, e->vr, e->nvr, &e->values[(index * e->nSteps + k) * e->nvr]);
+            if (s > status) status = s;
+            if (status > fmi2Warning) break;
+        }
+    }
+
+    e->status[index] = status;
+}
+
+/* Advance nInstances initialized instances of the same wrapped model in parallel by nSteps
+   communication steps starting at currentCommunicationPoint and record the Real variables vr
+   after every step in values[(instance * nSteps + step) * nvr + i]. The status of each instance
+   is returned in status and the worst one is returned. nThreads = 0 uses all processors. */
+FMI2_Export fmi2Status cswrapperDoStepEnsemble(fmi2Component instances[], size_t nInstances,
+                                               fmi2Real currentCommunicationPoint,
+                                               fmi2Real communicationStepSize,
+                                               size_t nSteps,
+                                               const fmi2ValueReference vr[], size_t nvr,
+                                               fmi2Real values[],
+                                               size_t nThreads,
+                                               fmi2Status status[]) {
+
+    if (!instances || !status || (nvr > 0 && (!vr || !values))) return fmi2Error;
+
+    for (size_t i = 0; i < nInstances; i++) {
+        if (!instances[i]) return fmi2Error;
+    }
+
+    if (nThreads == 0) {
+        nThreads = numberOfProcessors();
+    }
+
+    if (nThreads > nInstances) {
+        nThreads = nInstances > 0 ? nInstances : 1;
+    }
+
+    Ensemble e = {
+        .instances = (Model **)instances,
+        .currentCommunicationPoint = currentCommunicationPoint,
+        .communicationStepSize = communicationStepSize,
+        .nSteps = nSteps,
+        .vr = vr,
+        .nvr = nvr,
+        .values = values,
+        .status = status
+    };
+
+    ThreadPool *pool = createThreadPool(nThreads);
+
+    if (!pool) return fmi2Error;
+
+    runThreadPool(pool, doStepsTask, &e, nInstances);
+
+    freeThreadPool(pool);
+
+    fmi2Status worst = fmi2OK;
+
+    for (size_t i = 0; i < nInstances; i++) {
+        if (status[i] > worst) worst = status[i];
+    }
+
+    return worst;
+}
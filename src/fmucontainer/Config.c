@@ -0,0 +1,655 @@
+/* This file is part of FMPy. See LICENSE.txt for license information. */
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <mpack.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "FMI.h"
+
+#include "Config.h"
+
+
+#ifdef _WIN32
+static SRWLOCK cacheLock = SRWLOCK_INIT;
+#define LOCK_CACHE()    AcquireSRWLockExclusive(&cacheLock)
+#define UNLOCK_CACHE()  ReleaseSRWLockExclusive(&cacheLock)
+#else
+static pthread_mutex_t cacheLock = PTHREAD_MUTEX_INITIALIZER;
+#define LOCK_CACHE()    pthread_mutex_lock(&cacheLock)
+#define UNLOCK_CACHE()  pthread_mutex_unlock(&cacheLock)
+#endif
+
+// configurations that are in use by at least one instance
+static Config* cache = NULL;
+
+// the records are read directly from the file and must not contain padding
+typedef char CheckHeaderSize[sizeof(ConfigHeader) == 88 ? 1 : -1];
+typedef char CheckComponentSize[sizeof(ConfigComponent) == 48 ? 1 : -1];
+typedef char CheckConnectionSize[sizeof(ConfigConnection) == 40 ? 1 : -1];
+typedef char CheckVariableSize[sizeof(ConfigVariable) == 32 ? 1 : -1];
+typedef char CheckMappingSize[sizeof(ConfigMapping) == 16 ? 1 : -1];
+
+// Set the section pointers and check that all indices and offsets are within bounds
+static bool initConfig(Config* config) {
+
+    if (config->size < sizeof(ConfigHeader)) {
+        return false;
+    }
+
+    const ConfigHeader* header = (const ConfigHeader*)config->data;
+
+    if (memcmp(header->magic, CONFIG_MAGIC, sizeof(CONFIG_MAGIC)) || header->version != CONFIG_VERSION) {
+        return false;
+    }
+
+    // the counts are bounded by the file size, so the products can't overflow
+    const uint64_t counts[] = { header->nComponents, header->nConnections, header->nVariables, header->nMappings, header->stringsSize };
+
+    for (size_t i = 0; i < sizeof(counts) / sizeof(counts[0]); i++) {
+        if (counts[i] > config->size) {
+            return false;
+        }
+    }
+
+    const size_t size = sizeof(ConfigHeader) +
+        header->nComponents * sizeof(ConfigComponent) +
+        header->nConnections * sizeof(ConfigConnection) +
+        header->nVariables * sizeof(ConfigVariable) +
+        header->nMappings * sizeof(ConfigMapping) +
+        header->stringsSize;
+
+    if (size > config->size) {
+        return false;
+    }
+
+    const char* p = (const char*)config->data + sizeof(ConfigHeader);
+
+    config->header = header;
+    config->components = (const ConfigComponent*)p;
+    p += header->nComponents * sizeof(ConfigComponent);
+    config->connections = (const ConfigConnection*)p;
+    p += header->nConnections * sizeof(ConfigConnection);
+    config->variables = (const ConfigVariable*)p;
+    p += header->nVariables * sizeof(ConfigVariable);
+    config->mappings = (const ConfigMapping*)p;
+    p += header->nMappings * sizeof(ConfigMapping);
+    config->strings = p;
+
+    if (header->stringsSize > 0 && config->strings[header->stringsSize - 1] != '\0') {
+        return false;
+    }
+
+    for (size_t i = 0; i < header->nComponents; i++) {
+        const ConfigComponent* c = &config->components[i];
+        if (!configString(config, c->name) || !configString(config, c->fmiVersion) || !configString(config, c->guid) || !configString(config, c->modelIdentifier)) {
+            return false;
+        }
+    }
+
+    for (size_t i = 0; i < header->nConnections; i++) {
+        const ConfigConnection* k = &config->connections[i];
+        if (k->startComponent >= header->nComponents || k->endComponent >= header->nComponents || k->size == 0) {
+            return false;
+        }
+    }
+
+    for (size_t i = 0; i < header->nVariables; i++) {
+
+        const ConfigVariable* v = &config->variables[i];
+
+        if (v->mappings > header->nMappings || v->nMappings > header->nMappings - v->mappings) {
+            return false;
+        }
+
+        if (v->hasStart && v->type == FMIStringType && !configString(config, v->start.string)) {
+            return false;
+        }
+
+        size_t size;
+
+        if (v->hasStart && v->type == FMIBinaryType && !configBinary(config, v->start.binary, &size)) {
+            return false;
+        }
+    }
+
+    for (size_t i = 0; i < header->nMappings; i++) {
+        if (config->mappings[i].component >= header->nComponents) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static Config* mapConfig(const char* filename) {
+
+    Config* config = calloc(1, sizeof(Config));
+
+    if (!config) {
+        return NULL;
+    }
+
+    config->mapped = true;
+
+#ifdef _WIN32
+    HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+
+    if (file == INVALID_HANDLE_VALUE) {
+        free(config);
+        return NULL;
+    }
+
+    LARGE_INTEGER size;
+
+    if (GetFileSizeEx(file, &size) && size.QuadPart >= (LONGLONG)sizeof(ConfigHeader)) {
+
+        HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+
+        if (mapping) {
+            config->data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+            config->size = (size_t)size.QuadPart;
+            // the view keeps the mapping alive
+            CloseHandle(mapping);
+        }
+    }
+
+    CloseHandle(file);
+#else
+    const int fd = open(filename, O_RDONLY);
+
+    if (fd < 0) {
+        free(config);
+        return NULL;
+    }
+
+    struct stat st;
+
+    if (fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(ConfigHeader)) {
+
+        void* data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+        if (data != MAP_FAILED) {
+            config->data = data;
+            config->size = (size_t)st.st_size;
+        }
+    }
+
+    close(fd);
+#endif
+
+    if (!config->data || !initConfig(config)) {
+        freeConfig(config);
+        return NULL;
+    }
+
+    return config;
+}
+
+static size_t stringSize(mpack_node_t node) {
+    return mpack_node_strlen(node) + 1;
+}
+
+static size_t binarySize(mpack_node_t node) {
+    return sizeof(uint64_t) + mpack_node_bin_size(node);
+}
+
+static uint64_t copyBinary(mpack_node_t node, char* strings, size_t* position) {
+
+    const uint64_t offset = *position;
+    const uint64_t size = mpack_node_bin_size(node);
+
+    memcpy(&strings[*position], &size, sizeof(size));
+
+    if (size > 0) {
+        memcpy(&strings[*position + sizeof(size)], mpack_node_bin_data(node), size);
+    }
+
+    *position += sizeof(size) + size;
+
+    return offset;
+}
+
+static uint64_t copyString(mpack_node_t node, char* strings, size_t* position) {
+
+    const uint64_t offset = *position;
+    const size_t length = mpack_node_strlen(node);
+
+    if (length > 0) {
+        memcpy(&strings[*position], mpack_node_str(node), length);
+    }
+
+    strings[*position + length] = '\0';
+    *position += length + 1;
+
+    return offset;
+}
+
+// Convert config.mp to the flat layout
+static Config* convertConfig(const char* filename) {
+
+    static const char* masterAlgorithms[] = { "Jacobi", "GaussSeidel" };
+    static const char* interpolations[] = { "Hold", "Linear" };
+
+    Config* config = NULL;
+    char* data = NULL;
+
+    mpack_tree_t tree;
+    mpack_tree_init_filename(&tree, filename, 0);
+    mpack_tree_parse(&tree);
+    mpack_node_t root = mpack_tree_root(&tree);
+
+#ifdef _DEBUG
+    mpack_node_print_to_stdout(root);
+#endif
+
+    mpack_node_t components = mpack_node_map_cstr(root, "components");
+    mpack_node_t connections = mpack_node_map_cstr(root, "connections");
+    mpack_node_t variables = mpack_node_map_cstr(root, "variables");
+
+    const size_t nComponents = mpack_node_array_length(components);
+    const size_t nConnections = mpack_node_array_length(connections);
+    const size_t nVariables = mpack_node_array_length(variables);
+
+    size_t nMappings = 0;
+    size_t stringsSize = 0;
+
+    for (size_t i = 0; i < nComponents; i++) {
+        mpack_node_t component = mpack_node_array_at(components, i);
+        stringsSize += stringSize(mpack_node_map_cstr(component, "name"));
+        stringsSize += stringSize(mpack_node_map_cstr(component, "fmiVersion"));
+        stringsSize += stringSize(mpack_node_map_cstr(component, "guid"));
+        stringsSize += stringSize(mpack_node_map_cstr(component, "modelIdentifier"));
+    }
+
+    for (size_t i = 0; i < nVariables; i++) {
+
+        mpack_node_t variable = mpack_node_array_at(variables, i);
+
+        nMappings += mpack_node_array_length(mpack_node_map_cstr(variable, "components"));
+
+        if (!mpack_node_map_contains_cstr(variable, "start")) {
+            continue;
+        }
+
+        switch (mpack_node_int(mpack_node_map_cstr(variable, "type"))) {
+        case FMIStringType:
+            stringsSize += stringSize(mpack_node_map_cstr(variable, "start"));
+            break;
+        case FMIBinaryType:
+            stringsSize += binarySize(mpack_node_map_cstr(variable, "start"));
+            break;
+        default:
+            break;
+        }
+    }
+
+    // the string table ends with a null character even if the last entry is a Binary
+    stringsSize++;
+
+    const size_t size = sizeof(ConfigHeader) +
+        nComponents * sizeof(ConfigComponent) +
+        nConnections * sizeof(ConfigConnection) +
+        nVariables * sizeof(ConfigVariable) +
+        nMappings * sizeof(ConfigMapping) +
+        stringsSize;
+
+    data = calloc(1, size);
+
+    if (!data) {
+        mpack_tree_destroy(&tree);
+        return NULL;
+    }
+
+    ConfigHeader* header = (ConfigHeader*)data;
+    ConfigComponent* configComponents = (ConfigComponent*)&data[sizeof(ConfigHeader)];
+    ConfigConnection* configConnections = (ConfigConnection*)&configComponents[nComponents];
+    ConfigVariable* configVariables = (ConfigVariable*)&configConnections[nConnections];
+    ConfigMapping* configMappings = (ConfigMapping*)&configVariables[nVariables];
+    char* strings = (char*)&configMappings[nMappings];
+
+    size_t position = 0;
+
+    memcpy(header->magic, CONFIG_MAGIC, sizeof(CONFIG_MAGIC));
+    header->version = CONFIG_VERSION;
+    header->parallelDoStep = mpack_node_bool(mpack_node_map_cstr(root, "parallelDoStep"));
+    header->iterationTolerance = 1e-6;
+    header->nComponents = nComponents;
+    header->nConnections = nConnections;
+    header->nVariables = nVariables;
+    header->nMappings = nMappings;
+    header->stringsSize = stringsSize;
+
+    if (mpack_node_map_contains_cstr(root, "masterAlgorithm")) {
+        header->masterAlgorithm = (uint32_t)mpack_node_enum(mpack_node_map_cstr(root, "masterAlgorithm"), masterAlgorithms, 2);
+    }
+
+    if (mpack_node_map_contains_cstr(root, "maxIterations")) {
+        header->maxIterations = mpack_node_u64(mpack_node_map_cstr(root, "maxIterations"));
+    }
+
+    if (mpack_node_map_contains_cstr(root, "iterationTolerance")) {
+        header->iterationTolerance = mpack_node_double(mpack_node_map_cstr(root, "iterationTolerance"));
+    }
+
+    if (mpack_node_map_contains_cstr(root, "statistics")) {
+        header->statistics = mpack_node_bool(mpack_node_map_cstr(root, "statistics"));
+    }
+
+    if (mpack_node_map_contains_cstr(root, "threads")) {
+        header->threads = mpack_node_u64(mpack_node_map_cstr(root, "threads"));
+    }
+
+    for (size_t i = 0; i < nComponents; i++) {
+
+        mpack_node_t component = mpack_node_array_at(components, i);
+        ConfigComponent* c = &configComponents[i];
+
+        c->name = copyString(mpack_node_map_cstr(component, "name"), strings, &position);
+        c->fmiVersion = copyString(mpack_node_map_cstr(component, "fmiVersion"), strings, &position);
+        c->guid = copyString(mpack_node_map_cstr(component, "guid"), strings, &position);
+        c->modelIdentifier = copyString(mpack_node_map_cstr(component, "modelIdentifier"), strings, &position);
+
+        if (mpack_node_map_contains_cstr(component, "stepSize")) {
+            c->stepSize = mpack_node_double(mpack_node_map_cstr(component, "stepSize"));
+        }
+
+        if (mpack_node_map_contains_cstr(component, "interpolation")) {
+            c->interpolation = (uint32_t)mpack_node_enum(mpack_node_map_cstr(component, "interpolation"), interpolations, 2);
+        }
+
+        if (mpack_node_map_contains_cstr(component, "eventModeUsed") && mpack_node_bool(mpack_node_map_cstr(component, "eventModeUsed"))) {
+            c->flags |= CONFIG_EVENT_MODE_USED;
+        }
+
+        if (mpack_node_map_contains_cstr(component, "earlyReturnAllowed") && mpack_node_bool(mpack_node_map_cstr(component, "earlyReturnAllowed"))) {
+            c->flags |= CONFIG_EARLY_RETURN_ALLOWED;
+        }
+
+        if (mpack_node_map_contains_cstr(component, "canGetAndSetFMUState") && mpack_node_bool(mpack_node_map_cstr(component, "canGetAndSetFMUState"))) {
+            c->flags |= CONFIG_CAN_GET_AND_SET_FMU_STATE;
+        }
+    }
+
+    for (size_t i = 0; i < nConnections; i++) {
+
+        mpack_node_t connection = mpack_node_array_at(connections, i);
+        ConfigConnection* k = &configConnections[i];
+
+        k->type = (uint32_t)mpack_node_int(mpack_node_map_cstr(connection, "type"));
+        k->startComponent = mpack_node_u64(mpack_node_map_cstr(connection, "startComponent"));
+        k->endComponent = mpack_node_u64(mpack_node_map_cstr(connection, "endComponent"));
+        k->startValueReference = mpack_node_u32(mpack_node_map_cstr(connection, "startValueReference"));
+        k->endValueReference = mpack_node_u32(mpack_node_map_cstr(connection, "endValueReference"));
+
+        if (mpack_node_map_contains_cstr(connection, "delayed")) {
+            k->delayed = mpack_node_bool(mpack_node_map_cstr(connection, "delayed"));
+        }
+
+        k->size = mpack_node_map_contains_cstr(connection, "size") ? mpack_node_u64(mpack_node_map_cstr(connection, "size")) : 1;
+    }
+
+    size_t mapping = 0;
+
+    for (size_t i = 0; i < nVariables; i++) {
+
+        mpack_node_t variable = mpack_node_array_at(variables, i);
+        mpack_node_t variableComponents = mpack_node_map_cstr(variable, "components");
+        mpack_node_t valueReferences = mpack_node_map_cstr(variable, "valueReferences");
+        ConfigVariable* v = &configVariables[i];
+
+        v->type = (uint32_t)mpack_node_int(mpack_node_map_cstr(variable, "type"));
+        v->mappings = mapping;
+        v->nMappings = mpack_node_array_length(variableComponents);
+
+        for (size_t j = 0; j < v->nMappings; j++, mapping++) {
+            configMappings[mapping].component = mpack_node_u64(mpack_node_array_at(variableComponents, j));
+            configMappings[mapping].valueReference = mpack_node_u32(mpack_node_array_at(valueReferences, j));
+        }
+
+        if (!mpack_node_map_contains_cstr(variable, "start")) {
+            continue;
+        }
+
+        mpack_node_t start = mpack_node_map_cstr(variable, "start");
+
+        v->hasStart = 1;
+
+        switch (v->type) {
+        case FMIFloat32Type:
+        case FMIFloat64Type:
+            v->start.float64 = mpack_node_double(start);
+            break;
+        case FMIUInt8Type:
+        case FMIUInt16Type:
+        case FMIUInt32Type:
+        case FMIUInt64Type:
+            v->start.uint64 = mpack_node_u64(start);
+            break;
+        case FMIBooleanType:
+            v->start.int64 = mpack_node_bool(start);
+            break;
+        case FMIStringType:
+            v->start.string = copyString(start, strings, &position);
+            break;
+        case FMIBinaryType:
+            v->start.binary = copyBinary(start, strings, &position);
+            break;
+        default:
+            v->start.int64 = mpack_node_i64(start);
+            break;
+        }
+    }
+
+    // clean up and check for errors
+    if (mpack_tree_destroy(&tree) != mpack_ok) {
+        goto END;
+    }
+
+    config = calloc(1, sizeof(Config));
+
+    if (!config) {
+        goto END;
+    }
+
+    config->data = data;
+    config->size = size;
+
+    if (!initConfig(config)) {
+        free(config);
+        config = NULL;
+        goto END;
+    }
+
+    data = NULL;
+
+END:
+    free(data);
+
+    return config;
+}
+
+Config* readConfig(const char* resourcesDir) {
+
+    char filename[4096] = "";
+
+    strcpy(filename, resourcesDir);
+    strcat(filename, "config.bin");
+
+    Config* config = mapConfig(filename);
+
+    if (config) {
+        return config;
+    }
+
+    strcpy(filename, resourcesDir);
+    strcat(filename, "config.mp");
+
+    return convertConfig(filename);
+}
+
+Config* acquireConfig(const char* resourcesDir) {
+
+    LOCK_CACHE();
+
+    Config* config = cache;
+
+    while (config && strcmp(config->resourcesDir, resourcesDir)) {
+        config = config->next;
+    }
+
+    if (config) {
+        config->refCount++;
+        goto END;
+    }
+
+    config = readConfig(resourcesDir);
+
+    if (!config) {
+        goto END;
+    }
+
+    config->resourcesDir = strdup(resourcesDir);
+    config->libraries = calloc(config->header->nComponents, sizeof(void*));
+
+    if (!config->resourcesDir || !config->libraries) {
+        freeConfig(config);
+        config = NULL;
+        goto END;
+    }
+
+    config->refCount = 1;
+    config->next = cache;
+    cache = config;
+
+END:
+    UNLOCK_CACHE();
+
+    return config;
+}
+
+void retainLibrary(Config* config, size_t component, const char* libraryPath) {
+
+    if (!config->libraries || component >= config->header->nComponents) {
+        return;
+    }
+
+    LOCK_CACHE();
+
+    if (!config->libraries[component]) {
+#ifdef _WIN32
+        config->libraries[component] = LoadLibraryA(libraryPath);
+#else
+        config->libraries[component] = dlopen(libraryPath, RTLD_LAZY);
+#endif
+    }
+
+    UNLOCK_CACHE();
+}
+
+void releaseConfig(Config* config) {
+
+    if (!config) {
+        return;
+    }
+
+    LOCK_CACHE();
+
+    if (--config->refCount > 0) {
+        UNLOCK_CACHE();
+        return;
+    }
+
+    Config** entry = &cache;
+
+    while (*entry && *entry != config) {
+        entry = &(*entry)->next;
+    }
+
+    if (*entry) {
+        *entry = config->next;
+    }
+
+    UNLOCK_CACHE();
+
+    freeConfig(config);
+}
+
+const char* configString(const Config* config, uint64_t offset) {
+
+    if (offset >= config->header->stringsSize) {
+        return NULL;
+    }
+
+    return &config->strings[offset];
+}
+
+const uint8_t* configBinary(const Config* config, uint64_t offset, size_t* size) {
+
+    uint64_t n;
+
+    if (offset > config->header->stringsSize || config->header->stringsSize - offset < sizeof(n)) {
+        return NULL;
+    }
+
+    // the size is not aligned
+    memcpy(&n, &config->strings[offset], sizeof(n));
+
+    if (n > config->header->stringsSize - offset - sizeof(n)) {
+        return NULL;
+    }
+
+    *size = (size_t)n;
+
+    return (const uint8_t*)&config->strings[offset + sizeof(n)];
+}
+
+void freeConfig(Config* config) {
+
+    if (!config) {
+        return;
+    }
+
+    // the header is part of the data and must be read before it is unmapped
+    if (config->libraries) {
+        for (size_t i = 0; i < config->header->nComponents; i++) {
+            if (config->libraries[i]) {
+#ifdef _WIN32
+                FreeLibrary((HMODULE)config->libraries[i]);
+#else
+                dlclose(config->libraries[i]);
+#endif
+            }
+        }
+    }
+
+    free(config->libraries);
+
+    if (config->mapped) {
+#ifdef _WIN32
+        if (config->data) {
+            UnmapViewOfFile(config->data);
+        }
+#else
+        if (config->data) {
+            munmap(config->data, config->size);
+        }
+#endif
+    } else {
+        free(config->data);
+    }
+
+    free(config->resourcesDir);
+    free(config);
+}
@@ -0,0 +1,141 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+
+/* The configuration of a container in a flat layout that can be memory mapped. The file
+   config.bin consists of the header followed by the components, connections, variables,
+   mappings and the string table. Strings are referenced by their offset in the string
+   table and are null-terminated. All values are little-endian. */
+
+#define CONFIG_MAGIC "FMUCONF"
+#define CONFIG_VERSION 2
+
+typedef struct {
+
+    char magic[8];
+    uint32_t version;
+
+    uint32_t parallelDoStep;
+    uint32_t masterAlgorithm;
+    uint32_t statistics;
+
+    uint64_t threads;
+    uint64_t maxIterations;
+    double iterationTolerance;
+
+    uint64_t nComponents;
+    uint64_t nConnections;
+    uint64_t nVariables;
+    uint64_t nMappings;
+    uint64_t stringsSize;
+
+} ConfigHeader;
+
+typedef struct {
+
+    uint64_t name;
+    uint64_t fmiVersion;
+    uint64_t guid;
+    uint64_t modelIdentifier;
+
+    double stepSize;
+    uint32_t interpolation;
+    uint32_t flags;
+
+} ConfigComponent;
+
+// flags of a component
+#define CONFIG_EVENT_MODE_USED              1
+#define CONFIG_EARLY_RETURN_ALLOWED         2
+#define CONFIG_CAN_GET_AND_SET_FMU_STATE    4
+
+typedef struct {
+
+    uint32_t type;
+    uint32_t delayed;
+    uint64_t startComponent;
+    uint64_t endComponent;
+    uint32_t startValueReference;
+    uint32_t endValueReference;
+
+    // number of elements of the connected variables (1 for scalars)
+    uint64_t size;
+
+} ConfigConnection;
+
+typedef struct {
+
+    uint32_t type;
+    uint32_t hasStart;
+
+    // index of the first mapping and number of mappings
+    uint64_t mappings;
+    uint64_t nMappings;
+
+    // Float32 and Float64, the signed integer types and Boolean (0 or 1), the unsigned integer
+    // types, or the offset of a String or of a Binary (its size as uint64 followed by the data)
+    union {
+        double float64;
+        int64_t int64;
+        uint64_t uint64;
+        uint64_t string;
+        uint64_t binary;
+    } start;
+
+} ConfigVariable;
+
+typedef struct {
+
+    uint64_t component;
+    uint32_t valueReference;
+    uint32_t reserved;
+
+} ConfigMapping;
+
+typedef struct Config {
+
+    const ConfigHeader* header;
+    const ConfigComponent* components;
+    const ConfigConnection* connections;
+    const ConfigVariable* variables;
+    const ConfigMapping* mappings;
+    const char* strings;
+
+    // the memory mapped file or the buffer that holds the configuration
+    void* data;
+    size_t size;
+    bool mapped;
+
+    // the entry in the process-wide cache (see acquireConfig())
+    char* resourcesDir;
+    size_t refCount;
+    struct Config* next;
+
+    // handles that keep the platform binaries of the components loaded (nComponents)
+    void** libraries;
+
+} Config;
+
+/* Map resources/config.bin or, if it doesn't exist, convert resources/config.mp */
+Config* readConfig(const char* resourcesDir);
+
+/* Get the configuration for resourcesDir from the process-wide cache or read and add it */
+Config* acquireConfig(const char* resourcesDir);
+
+/* Keep the platform binary of a component loaded as long as the configuration is cached */
+void retainLibrary(Config* config, size_t component, const char* libraryPath);
+
+/* Release a configuration returned by acquireConfig() and free it when it is no longer used */
+void releaseConfig(Config* config);
+
+const char* configString(const Config* config, uint64_t offset);
+
+const uint8_t* configBinary(const Config* config, uint64_t offset, size_t* size);
+
+void freeConfig(Config* config);
+
+#endif
@@ -12,8 +12,8 @@
 #include <linux/limits.h>
 #endif
 
-#include <mpack.h>
-
+#include <stdint.h>
+#include <math.h>
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -29,82 +29,95 @@
 
 #define CHECK_STATUS(S) status = S; if (status > FMIWarning) goto END
 
+// tolerance for the comparison of communication points
+#define EPSILON(T) (1e-9 * (1.0 + fabs(T)))
 
-#ifdef _WIN32
-static DWORD WINAPI instanceDoStep(LPVOID lpParam) {
+// maximum number of updates of the discrete states at an event
+#define MAX_EVENT_ITERATIONS 100
 
-    Component *c = (Component *)lpParam;
 
-    while (true) {
+// Advance the component from currentCommunicationPoint by communicationStepSize. Components
+// with a smaller step size of their own take several steps.
+static FMIStatus componentDoStep(Component *c) {
 
-        DWORD dwWaitResult = WaitForSingleObject(c->mutex, INFINITE);
+    FMIStatus status = FMIOK;
 
-        if (c->terminate) {
-            return TRUE;
-        }
+    const double startWallTime = c->statistics ? wallTime() : 0;
+    const double startCPUTime = c->statistics ? threadCPUTime() : 0;
 
-        if (c->doStep) {
-            switch (c->instance->fmiMajorVersion) {
-            case FMIMajorVersion2:
-                c->status = FMI2DoStep(c->instance, c->currentCommunicationPoint, c->communicationStepSize, c->noSetFMUStatePriorToCurrentPoint);
-                break;
-            case FMIMajorVersion3: ;
-                fmi3Boolean eventHandlingNeeded;
-                fmi3Boolean terminateSimulation;
-                fmi3Boolean earlyReturn;
-                fmi3Float64 lastSuccessfulTime;
-    
-                c->status = FMI3DoStep(c->instance, c->currentCommunicationPoint, c->communicationStepSize, c->noSetFMUStatePriorToCurrentPoint, &eventHandlingNeeded, &terminateSimulation, &earlyReturn, &lastSuccessfulTime);
-                break;
-            default:
-                break;
-            }
-            c->doStep = false;
+    const double stopTime = c->currentCommunicationPoint + c->communicationStepSize;
+
+    double time = c->currentCommunicationPoint;
+
+    c->earlyReturn = false;
+    c->eventHandlingNeeded = false;
+    c->terminateSimulation = false;
+
+    do {
+
+        double h = stopTime - time;
+
+        if (c->stepSize > 0 && c->stepSize < h - EPSILON(stopTime)) {
+            h = c->stepSize;
         }
 
-        BOOL success = ReleaseMutex(c->mutex);
-    }
+        FMIStatus stepStatus = FMIOK;
 
-    return TRUE;
-}
-#else
-static void* instanceDoStep(void *arg) {
+        switch (c->instance->fmiMajorVersion) {
+        case FMIMajorVersion2:
+            stepStatus = FMI2DoStep(c->instance, time, h, c->noSetFMUStatePriorToCurrentPoint);
+            break;
+        case FMIMajorVersion3: ;
+            fmi3Boolean eventHandlingNeeded = fmi3False;
+            fmi3Boolean terminateSimulation = fmi3False;
+            fmi3Boolean earlyReturn = fmi3False;
+            fmi3Float64 lastSuccessfulTime = time + h;
 
-    Component *c = (Component *)arg;
+            stepStatus = FMI3DoStep(c->instance, time, h, c->noSetFMUStatePriorToCurrentPoint, &eventHandlingNeeded, &terminateSimulation, &earlyReturn, &lastSuccessfulTime);
 
-    while (true) {
+            c->eventHandlingNeeded = eventHandlingNeeded;
+            c->terminateSimulation = terminateSimulation;
 
-        pthread_mutex_lock(&c->mutex);
+            // the component has stopped at an event
+            if (earlyReturn && c->earlyReturnAllowed) {
+                c->earlyReturn = true;
+                h = lastSuccessfulTime - time;
+            }
+            break;
+        default:
+            break;
+        }
 
-        if (c->terminate) {
-            return NULL;
+        if (stepStatus > status) {
+            status = stepStatus;
         }
 
-        if (c->doStep) {
-            switch (c->instance->fmiMajorVersion) {
-            case FMIMajorVersion2:
-                c->status = FMI2DoStep(c->instance, c->currentCommunicationPoint, c->communicationStepSize, c->noSetFMUStatePriorToCurrentPoint);
-                break;
-            case FMIMajorVersion3: ;
-                fmi3Boolean eventHandlingNeeded;
-                fmi3Boolean terminateSimulation;
-                fmi3Boolean earlyReturn;
-                fmi3Float64 lastSuccessfulTime;
-    
-                c->status = FMI3DoStep(c->instance, c->currentCommunicationPoint, c->communicationStepSize, c->noSetFMUStatePriorToCurrentPoint, &eventHandlingNeeded, &terminateSimulation, &earlyReturn, &lastSuccessfulTime);
-                break;
-            default:
-                break;
-            }
-            c->doStep = false;
+        if (status > FMIWarning) {
+            break;
         }
 
-        pthread_mutex_unlock(&c->mutex);
+        time += h;
+
+        c->time = time;
+
+    } while (time < stopTime - EPSILON(stopTime) && !c->earlyReturn && !c->eventHandlingNeeded && !c->terminateSimulation);
+
+    if (c->statistics) {
+        c->stepEndTime = wallTime();
+        addSample(&c->statistics->doStepWallTime, c->stepEndTime - startWallTime);
+        addSample(&c->statistics->doStepCPUTime, threadCPUTime() - startCPUTime);
     }
 
-    return NULL;
+    return status;
+}
+
+static void doStepTask(void *context, size_t index) {
+
+    Wavefront *w = (Wavefront *)context;
+    Component *c = w->components[index];
+
+    c->status = c->active ? componentDoStep(c) : FMIOK;
 }
-#endif
 
 
 static void logFMIMessage(FMIInstance *instance, FMIStatus status, const char *category, const char *message) {
@@ -175,29 +188,78 @@ static void logFunctionCall(FMIInstance *instance, FMIStatus status, const char
     }
 }
 
+static void logSystemMessage(System *s, FMIStatus status, const char *category, const char *message, ...) {
+
+    if (!s->logMessage) {
+        return;
+    }
+
+    char buf[FMI_MAX_MESSAGE_LENGTH] = "";
+
+    va_list args;
+
+    va_start(args, message);
+    vsnprintf(buf, FMI_MAX_MESSAGE_LENGTH, message, args);
+    va_end(args);
+
+    switch (s->fmiMajorVersion) {
+    case FMIMajorVersion2:
+        ((fmi2CallbackLogger)s->logMessage)(s->instanceEnvironment, s->instanceName, status, category, buf);
+        break;
+    case FMIMajorVersion3:
+        ((fmi3LogMessageCallback)s->logMessage)(s->instanceEnvironment, status, category, buf);
+        break;
+    default:
+        break;
+    }
+}
+
 #define CHECK_STATUS(S) status = S; if (status > FMIWarning) goto END
 
+#define MIN(A, B) ((A) < (B) ? (A) : (B))
+
+size_t sizeOfVariableType(FMIVariableType variableType) {
+
+    switch (variableType) {
+    case FMIFloat32Type: return sizeof(fmi3Float32);
+    case FMIFloat64Type: return sizeof(fmi3Float64);
+    case FMIInt8Type:    return sizeof(fmi3Int8);
+    case FMIUInt8Type:   return sizeof(fmi3UInt8);
+    case FMIInt16Type:   return sizeof(fmi3Int16);
+    case FMIUInt16Type:  return sizeof(fmi3UInt16);
+    case FMIInt32Type:   return sizeof(fmi3Int32);
+    case FMIUInt32Type:  return sizeof(fmi3UInt32);
+    case FMIInt64Type:   return sizeof(fmi3Int64);
+    case FMIUInt64Type:  return sizeof(fmi3UInt64);
+    case FMIBooleanType: return sizeof(fmi3Boolean);
+    case FMIStringType:  return sizeof(fmi3String);
+    case FMIBinaryType:  return sizeof(BinaryValue);
+    case FMIClockType:   return sizeof(fmi3Clock);
+    default:             return 0;
+    }
+}
+
 FMIStatus getVariable(
     FMIInstance *instance,
     FMIVariableType variableType,
-    const FMIValueReference* valueReference,
-    void* value) {
+    const FMIValueReference valueReferences[],
+    size_t nValueReferences,
+    void* values,
+    size_t nValues) {
 
     FMIStatus status = FMIOK;
 
     switch (variableType) {
     case FMIFloat32Type:
-        CHECK_STATUS(FMI3GetFloat32(instance, valueReference, 1, value, 1));
+        CHECK_STATUS(FMI3GetFloat32(instance, valueReferences, nValueReferences, values, nValues));
         break;
     case FMIFloat64Type:
         switch (instance->fmiMajorVersion) {
-        case FMIMajorVersion2: ;
-            fmi2Real v;
-            CHECK_STATUS(FMI2GetReal(instance, valueReference, 1, &v));
-            *((fmi3Float64 *) value) = (fmi3Float64) v;
+        case FMIMajorVersion2:
+            CHECK_STATUS(FMI2GetReal(instance, valueReferences, nValueReferences, values));
             break;
         case FMIMajorVersion3:
-            CHECK_STATUS(FMI3GetFloat64(instance, valueReference, 1, value, 1));
+            CHECK_STATUS(FMI3GetFloat64(instance, valueReferences, nValueReferences, values, nValues));
             break;
         default:
             status = FMIError;
@@ -205,28 +267,24 @@ FMIStatus getVariable(
         }
         break;
     case FMIInt8Type:
-        CHECK_STATUS(FMI3GetInt8(instance, valueReference, 1, value, 1));
+        CHECK_STATUS(FMI3GetInt8(instance, valueReferences, nValueReferences, values, nValues));
         break;
     case FMIUInt8Type:
-        CHECK_STATUS(FMI3GetUInt8(instance, valueReference, 1, value, 1));
+        CHECK_STATUS(FMI3GetUInt8(instance, valueReferences, nValueReferences, values, nValues));
         break;
     case FMIInt16Type:
-        CHECK_STATUS(FMI3GetInt16(instance, valueReference, 1, value, 1));
+        CHECK_STATUS(FMI3GetInt16(instance, valueReferences, nValueReferences, values, nValues));
         break;
     case FMIUInt16Type:
-        CHECK_STATUS(FMI3GetUInt16(instance, valueReference, 1, value, 1));
+        CHECK_STATUS(FMI3GetUInt16(instance, valueReferences, nValueReferences, values, nValues));
         break;
     case FMIInt32Type:
         switch (instance->fmiMajorVersion) {
-        case FMIMajorVersion2: ;
-            {
-            fmi2Integer v;
-            CHECK_STATUS(FMI2GetInteger(instance, valueReference, 1, &v));
-            *((fmi3Int32 *) value) = (fmi3Int32) v;
+        case FMIMajorVersion2:
+            CHECK_STATUS(FMI2GetInteger(instance, valueReferences, nValueReferences, values));
             break;
-            }
         case FMIMajorVersion3:
-            CHECK_STATUS(FMI3GetInt32(instance, valueReference, 1, value, 1));
+            CHECK_STATUS(FMI3GetInt32(instance, valueReferences, nValueReferences, values, nValues));
             break;
         default:
             status = FMIError;
@@ -234,17 +292,22 @@ FMIStatus getVariable(
         }
         break;
     case FMIUInt32Type:
-        CHECK_STATUS(FMI3GetUInt32(instance, valueReference, 1, value, 1));
+        CHECK_STATUS(FMI3GetUInt32(instance, valueReferences, nValueReferences, values, nValues));
         break;
     case FMIInt64Type:
         switch (instance->fmiMajorVersion) {
-        case FMIMajorVersion2: ;
-            fmi2Integer v;
-            CHECK_STATUS(FMI2GetInteger(instance, valueReference, 1, &v));
-            *((fmi3Int64 *) value) = (fmi3Int64) v;
+        case FMIMajorVersion2:
+            for (size_t i = 0; i < nValueReferences; i += CONVERSION_BUFFER_SIZE) {
+                const size_t n = MIN(CONVERSION_BUFFER_SIZE, nValueReferences - i);
+                fmi2Integer v[CONVERSION_BUFFER_SIZE];
+                CHECK_STATUS(FMI2GetInteger(instance, &valueReferences[i], n, v));
+                for (size_t j = 0; j < n; j++) {
+                    ((fmi3Int64 *)values)[i + j] = (fmi3Int64)v[j];
+                }
+            }
             break;
         case FMIMajorVersion3:
-            CHECK_STATUS(FMI3GetInt64(instance, valueReference, 1, value, 1));
+            CHECK_STATUS(FMI3GetInt64(instance, valueReferences, nValueReferences, values, nValues));
             break;
         default:
             status = FMIError;
@@ -252,17 +315,22 @@ FMIStatus getVariable(
         }
         break;
     case FMIUInt64Type:
-        CHECK_STATUS(FMI3GetUInt64(instance, valueReference, 1, value, 1));
+        CHECK_STATUS(FMI3GetUInt64(instance, valueReferences, nValueReferences, values, nValues));
         break;
     case FMIBooleanType:
         switch (instance->fmiMajorVersion) {
-        case FMIMajorVersion2: ;
-            fmi2Boolean v;
-            CHECK_STATUS(FMI2GetBoolean(instance, valueReference, 1, &v));
-            *((fmi3Boolean *) value) = (fmi3Boolean) v;
+        case FMIMajorVersion2:
+            for (size_t i = 0; i < nValueReferences; i += CONVERSION_BUFFER_SIZE) {
+                const size_t n = MIN(CONVERSION_BUFFER_SIZE, nValueReferences - i);
+                fmi2Boolean v[CONVERSION_BUFFER_SIZE];
+                CHECK_STATUS(FMI2GetBoolean(instance, &valueReferences[i], n, v));
+                for (size_t j = 0; j < n; j++) {
+                    ((fmi3Boolean *)values)[i + j] = v[j] != fmi2False;
+                }
+            }
             break;
         case FMIMajorVersion3:
-            CHECK_STATUS(FMI3GetBoolean(instance, valueReference, 1, value, 1));
+            CHECK_STATUS(FMI3GetBoolean(instance, valueReferences, nValueReferences, values, nValues));
             break;
         default:
             status = FMIError;
@@ -272,22 +340,30 @@ FMIStatus getVariable(
     case FMIStringType:
         switch (instance->fmiMajorVersion) {
         case FMIMajorVersion2:
-            CHECK_STATUS(FMI2GetString(instance, valueReference, 1, value));
+            CHECK_STATUS(FMI2GetString(instance, valueReferences, nValueReferences, values));
             break;
         case FMIMajorVersion3:
-            CHECK_STATUS(FMI3GetString(instance, valueReference, 1, value, 1));
+            CHECK_STATUS(FMI3GetString(instance, valueReferences, nValueReferences, values, nValues));
             break;
         default:
             status = FMIError;
             break;
         }
         break;
-    // TODO: implement
     case FMIBinaryType:
-        status = FMIError;
+        for (size_t i = 0; i < nValueReferences; i += CONVERSION_BUFFER_SIZE) {
+            const size_t n = MIN(CONVERSION_BUFFER_SIZE, nValueReferences - i);
+            size_t sizes[CONVERSION_BUFFER_SIZE];
+            fmi3Binary v[CONVERSION_BUFFER_SIZE];
+            CHECK_STATUS(FMI3GetBinary(instance, &valueReferences[i], n, sizes, v, n));
+            for (size_t j = 0; j < n; j++) {
+                ((BinaryValue *)values)[i + j].size = sizes[j];
+                ((BinaryValue *)values)[i + j].data = v[j];
+            }
+        }
         break;
     case FMIClockType:
-        status = FMIError;
+        CHECK_STATUS(FMI3GetClock(instance, valueReferences, nValueReferences, values));
         break;
     default:
         status = FMIError;
@@ -300,23 +376,24 @@ END:
 FMIStatus setVariable(
     FMIInstance *instance,
     FMIVariableType variableType,
-    const FMIValueReference* valueReference,
-    void* value) {
+    const FMIValueReference valueReferences[],
+    size_t nValueReferences,
+    const void* values,
+    size_t nValues) {
 
     FMIStatus status = FMIOK;
 
     switch (variableType) {
     case FMIFloat32Type:
-        CHECK_STATUS(FMI3SetFloat32(instance, valueReference, 1, value, 1));
+        CHECK_STATUS(FMI3SetFloat32(instance, valueReferences, nValueReferences, values, nValues));
         break;
     case FMIFloat64Type:
         switch (instance->fmiMajorVersion) {
-        case FMIMajorVersion2: ;
-            fmi2Real v = *((fmi3Float64 *) value);
-            CHECK_STATUS(FMI2SetReal(instance, valueReference, 1, &v));
+        case FMIMajorVersion2:
+            CHECK_STATUS(FMI2SetReal(instance, valueReferences, nValueReferences, values));
             break;
         case FMIMajorVersion3:
-            CHECK_STATUS(FMI3SetFloat64(instance, valueReference, 1, value, 1));
+            CHECK_STATUS(FMI3SetFloat64(instance, valueReferences, nValueReferences, values, nValues));
             break;
         default:
             status = FMIError;
@@ -324,46 +401,47 @@ FMIStatus setVariable(
         }
         break;
     case FMIInt8Type:
-        CHECK_STATUS(FMI3SetInt8(instance, valueReference, 1, value, 1));
+        CHECK_STATUS(FMI3SetInt8(instance, valueReferences, nValueReferences, values, nValues));
         break;
     case FMIUInt8Type:
-        CHECK_STATUS(FMI3SetUInt8(instance, valueReference, 1, value, 1));
+        CHECK_STATUS(FMI3SetUInt8(instance, valueReferences, nValueReferences, values, nValues));
         break;
     case FMIInt16Type:
-        CHECK_STATUS(FMI3SetInt16(instance, valueReference, 1, value, 1));
+        CHECK_STATUS(FMI3SetInt16(instance, valueReferences, nValueReferences, values, nValues));
         break;
     case FMIUInt16Type:
-        CHECK_STATUS(FMI3SetUInt16(instance, valueReference, 1, value, 1));
+        CHECK_STATUS(FMI3SetUInt16(instance, valueReferences, nValueReferences, values, nValues));
         break;
     case FMIInt32Type:
         switch (instance->fmiMajorVersion) {
-        case FMIMajorVersion2: ;
-            {
-            fmi2Integer v = (fmi2Integer) *((fmi3Int32 *) value);
-            CHECK_STATUS(FMI2SetInteger(instance, valueReference, 1, &v));
+        case FMIMajorVersion2:
+            CHECK_STATUS(FMI2SetInteger(instance, valueReferences, nValueReferences, values));
             break;
-            }
         case FMIMajorVersion3:
-            {
-            CHECK_STATUS(FMI3SetInt32(instance, valueReference, 1, value, 1));
+            CHECK_STATUS(FMI3SetInt32(instance, valueReferences, nValueReferences, values, nValues));
             break;
-            }
         default:
             status = FMIError;
             break;
         }
         break;
     case FMIUInt32Type:
-        CHECK_STATUS(FMI3SetUInt32(instance, valueReference, 1, value, 1));
+        CHECK_STATUS(FMI3SetUInt32(instance, valueReferences, nValueReferences, values, nValues));
         break;
     case FMIInt64Type:
         switch (instance->fmiMajorVersion) {
-        case FMIMajorVersion2: ;
-            fmi2Integer v = (fmi2Integer) *((fmi3Int64 *) value);
-            CHECK_STATUS(FMI2SetInteger(instance, valueReference, 1, &v));
+        case FMIMajorVersion2:
+            for (size_t i = 0; i < nValueReferences; i += CONVERSION_BUFFER_SIZE) {
+                const size_t n = MIN(CONVERSION_BUFFER_SIZE, nValueReferences - i);
+                fmi2Integer v[CONVERSION_BUFFER_SIZE];
+                for (size_t j = 0; j < n; j++) {
+                    v[j] = (fmi2Integer)((const fmi3Int64 *)values)[i + j];
+                }
+                CHECK_STATUS(FMI2SetInteger(instance, &valueReferences[i], n, v));
+            }
             break;
         case FMIMajorVersion3:
-            CHECK_STATUS(FMI3SetInt64(instance, valueReference, 1, value, 1));
+            CHECK_STATUS(FMI3SetInt64(instance, valueReferences, nValueReferences, values, nValues));
             break;
         default:
             status = FMIError;
@@ -371,16 +449,22 @@ FMIStatus setVariable(
         }
         break;
     case FMIUInt64Type:
-        CHECK_STATUS(FMI3SetUInt64(instance, valueReference, 1, value, 1));
+        CHECK_STATUS(FMI3SetUInt64(instance, valueReferences, nValueReferences, values, nValues));
         break;
     case FMIBooleanType:
         switch (instance->fmiMajorVersion) {
-        case FMIMajorVersion2: ;
-            fmi2Boolean v = (fmi2Boolean) *((fmi3Boolean *) value);
-            CHECK_STATUS(FMI2SetBoolean(instance, valueReference, 1, &v));
+        case FMIMajorVersion2:
+            for (size_t i = 0; i < nValueReferences; i += CONVERSION_BUFFER_SIZE) {
+                const size_t n = MIN(CONVERSION_BUFFER_SIZE, nValueReferences - i);
+                fmi2Boolean v[CONVERSION_BUFFER_SIZE];
+                for (size_t j = 0; j < n; j++) {
+                    v[j] = ((const fmi3Boolean *)values)[i + j] ? fmi2True : fmi2False;
+                }
+                CHECK_STATUS(FMI2SetBoolean(instance, &valueReferences[i], n, v));
+            }
             break;
         case FMIMajorVersion3:
-            CHECK_STATUS(FMI3SetBoolean(instance, valueReference, 1, value, 1));
+            CHECK_STATUS(FMI3SetBoolean(instance, valueReferences, nValueReferences, values, nValues));
             break;
         default:
             status = FMIError;
@@ -390,22 +474,30 @@ FMIStatus setVariable(
     case FMIStringType:
         switch (instance->fmiMajorVersion) {
         case FMIMajorVersion2:
-            CHECK_STATUS(FMI2SetString(instance, valueReference, 1, value));
+            CHECK_STATUS(FMI2SetString(instance, valueReferences, nValueReferences, values));
             break;
         case FMIMajorVersion3:
-            CHECK_STATUS(FMI3SetString(instance, valueReference, 1, value, 1));
+            CHECK_STATUS(FMI3SetString(instance, valueReferences, nValueReferences, values, nValues));
             break;
         default:
             status = FMIError;
             break;
         }
         break;
-    // TODO: implement
     case FMIBinaryType:
-        status = FMIError;
+        for (size_t i = 0; i < nValueReferences; i += CONVERSION_BUFFER_SIZE) {
+            const size_t n = MIN(CONVERSION_BUFFER_SIZE, nValueReferences - i);
+            size_t sizes[CONVERSION_BUFFER_SIZE];
+            fmi3Binary v[CONVERSION_BUFFER_SIZE];
+            for (size_t j = 0; j < n; j++) {
+                sizes[j] = ((const BinaryValue *)values)[i + j].size;
+                v[j] = ((const BinaryValue *)values)[i + j].data;
+            }
+            CHECK_STATUS(FMI3SetBinary(instance, &valueReferences[i], n, sizes, v, n));
+        }
         break;
     case FMIClockType:
-        status = FMIError;
+        CHECK_STATUS(FMI3SetClock(instance, valueReferences, nValueReferences, values));
         break;
     default:
         status = FMIError;
@@ -415,455 +507,2052 @@ END:
     return status;
 }
 
-System* instantiateSystem(
-    FMIMajorVersion fmiMajorVersion,
-    const char* resourcesDir,
-    const char* instanceName,
-    void* logMessage,
-    void* instanceEnvironment,
-    bool loggingOn,
-    bool visible) {
+// Sort the values by component and get or set them with one call per component. The values
+// of container variables that are mapped to several components are set on all of them.
+static FMIStatus dispatchVariables(
+    System* s,
+    FMIVariableType variableType,
+    const FMIValueReference valueReferences[],
+    size_t nValueReferences,
+    void* values,
+    bool set) {
 
-    char configFilename[4096] = "";
-    strcpy(configFilename, resourcesDir);
-    strcat(configFilename, "config.mp");
+    FMIStatus status = FMIOK;
 
-    // parse a file into a node tree
-    mpack_tree_t tree;
-    mpack_tree_init_filename(&tree, configFilename, 0);
-    mpack_tree_parse(&tree);
-    mpack_node_t root = mpack_tree_root(&tree);
+    Dispatch* d = &s->dispatch;
 
-#ifdef _DEBUG
-    mpack_node_print_to_stdout(root);
-#endif
+    const size_t size = sizeOfVariableType(variableType);
 
-    mpack_node_t parallelDoStep = mpack_node_map_cstr(root, "parallelDoStep");
+    if (!d->offsets) {
 
-    System* s = calloc(1, sizeof(System));
+        d->offsets = calloc(s->nComponents + 1, sizeof(size_t));
+        d->positions = calloc(s->nComponents, sizeof(size_t));
 
-    s->fmiMajorVersion = fmiMajorVersion;
-    s->instanceName = strdup(instanceName);
-    s->instanceEnvironment = instanceEnvironment;
-    s->logMessage = logMessage;
-    s->parallelDoStep = mpack_node_bool(parallelDoStep);
-    s->time = 0;
+        if (!d->offsets || (s->nComponents > 0 && !d->positions)) {
+            return FMIError;
+        }
+    }
+
+    memset(d->offsets, 0, (s->nComponents + 1) * sizeof(size_t));
+
+    // count the values of every component
+    for (size_t i = 0; i < nValueReferences; i++) {
+
+        const FMIValueReference vr = valueReferences[i];
 
-    mpack_node_t components = mpack_node_map_cstr(root, "components");
+        // the value reference 0 is the time
+        if (vr == 0 && variableType == FMIFloat64Type && !set) {
+            ((fmi3Float64*)values)[i] = s->time;
+            continue;
+        }
+
+        if (vr == 0 || vr > s->nVariables) {
+            return FMIError;
+        }
 
-    s->nComponents = mpack_node_array_length(components);
+        const VariableMapping* vm = &s->variables[vr - 1];
+        const size_t nMappings = set ? vm->size : MIN(vm->size, 1);
 
-    s->components = calloc(s->nComponents, sizeof(FMIInstance*));
+        for (size_t j = 0; j < nMappings; j++) {
+            d->offsets[vm->ci[j] + 1]++;
+        }
+    }
 
     for (size_t i = 0; i < s->nComponents; i++) {
-        Component* c = calloc(1, sizeof(Component));
+        d->offsets[i + 1] += d->offsets[i];
+        d->positions[i] = d->offsets[i];
+    }
 
-        mpack_node_t component = mpack_node_array_at(components, i);
+    const size_t n = d->offsets[s->nComponents];
 
-        mpack_node_t name = mpack_node_map_cstr(component, "name");
-        char* _name = mpack_node_cstr_alloc(name, 1024);
+    if (n > d->capacity) {
 
-        mpack_node_t componentFmiVersion = mpack_node_map_cstr(component, "fmiVersion");
-        char* _componentFmiVersion = mpack_node_cstr_alloc(componentFmiVersion, 1024);
+        size_t* indices = realloc(d->indices, n * sizeof(size_t));
 
-        FMIMajorVersion componentFmiMajorVersion;
-        if (*_componentFmiVersion == '2') {
-            componentFmiMajorVersion = FMIMajorVersion2;
-        } else if (*_componentFmiVersion == '3') {
-            componentFmiMajorVersion = FMIMajorVersion3;
-        } else {
-            return NULL;
+        if (!indices) {
+            return FMIError;
         }
 
-        mpack_node_t guid = mpack_node_map_cstr(component, "guid");
-        char* _guid = mpack_node_cstr_alloc(guid, 1024);
+        d->indices = indices;
 
-        mpack_node_t modelIdentifier = mpack_node_map_cstr(component, "modelIdentifier");
-        char* _modelIdentifier = mpack_node_cstr_alloc(modelIdentifier, 1024);
+        FMIValueReference* vrs = realloc(d->valueReferences, n * sizeof(FMIValueReference));
 
-        char unzipdir[4069] = "";
-        char componentResourcesDir[4069] = "";
+        if (!vrs) {
+            return FMIError;
+        }
 
-#ifdef _WIN32
-        PathCombine(unzipdir, resourcesDir, _modelIdentifier);
-        PathCombine(componentResourcesDir, unzipdir, "resources");
-#else
-        sprintf(unzipdir, "%s/%s", resourcesDir, _modelIdentifier);
-        sprintf(componentResourcesDir, "%s/%s", unzipdir, "resources");
-#endif
-        char componentResourcesUri[4069] = "";
+        d->valueReferences = vrs;
+        d->capacity = n;
+    }
 
-        FMIPathToURI(componentResourcesDir, componentResourcesUri, 4096);
+    if (n * size > d->valuesSize) {
 
-        char libraryPath[4069] = "";
+        void* buffer = realloc(d->values, n * size);
 
-        switch (componentFmiMajorVersion) {
-        case FMIMajorVersion2:
-            FMIPlatformBinaryPath(unzipdir, _modelIdentifier, FMIMajorVersion2, libraryPath, 4096);
-            break;
-        case FMIMajorVersion3:
-            FMIPlatformBinaryPath(unzipdir, _modelIdentifier, FMIMajorVersion3, libraryPath, 4096);
-            break;
-        default:
-            break;
+        if (!buffer) {
+            return FMIError;
         }
 
-        FMIInstance* m = FMICreateInstance(_name, logFMIMessage, loggingOn ? logFunctionCall : NULL);
-        FMILoadPlatformBinary(m, libraryPath);
+        d->values = buffer;
+        d->valuesSize = n * size;
+    }
 
-        if (!m) {
-            return NULL;
-        }
+    for (size_t i = 0; i < nValueReferences; i++) {
 
-        m->userData = s;
+        const FMIValueReference vr = valueReferences[i];
 
-        switch (componentFmiMajorVersion) {
-        case FMIMajorVersion2:
-            if (FMI2Instantiate(m, componentResourcesDir, fmi2CoSimulation, _guid, visible, loggingOn) > FMIWarning) {
-                return NULL;
-            }
-            break;
-        case FMIMajorVersion3:
-            // TODO: Add support for some FMI3 options if necessary
-            //           (hasEventMode=false, mightReturnEarlyFromDoStep=true, etc.)
-            if (FMI3InstantiateCoSimulation(m, _guid, componentResourcesDir, visible, loggingOn, true, false, NULL, 0, NULL ) > FMIWarning) {
-                return NULL;
-            }
-            break;
-        default:
-            break;
+        if (vr == 0) {
+            continue;
         }
 
-        c->instance = m;
+        const VariableMapping* vm = &s->variables[vr - 1];
+        const size_t nMappings = set ? vm->size : MIN(vm->size, 1);
 
-        if (s->parallelDoStep) {
-            c->doStep = false;
-            c->terminate = false;
-#ifdef _WIN32
-            // TODO: check for invalid handles
-            c->mutex = CreateMutexA(NULL, FALSE, NULL);
-            c->thread = CreateThread(NULL, 0, instanceDoStep, c, 0, NULL);
-#else
-            // TODO: check return codes
-            pthread_mutex_init(&c->mutex, NULL);
-            pthread_create(&c->thread, NULL, &instanceDoStep, c);
-#endif
+        for (size_t j = 0; j < nMappings; j++) {
+            const size_t position = d->positions[vm->ci[j]]++;
+            d->valueReferences[position] = vm->vr[j];
+            d->indices[position] = i;
         }
-
-        s->components[i] = c;
     }
 
-    mpack_node_t connections = mpack_node_map_cstr(root, "connections");
+    for (size_t i = 0; i < s->nComponents; i++) {
+
+        const size_t offset = d->offsets[i];
+        const size_t count = d->offsets[i + 1] - offset;
 
-    s->nConnections = mpack_node_array_length(connections);
+        if (count == 0) {
+            continue;
+        }
 
-    s->connections = calloc(s->nConnections, sizeof(Connection));
+        FMIInstance* m = s->components[i]->instance;
+        char* buffer = (char*)d->values + offset * size;
 
-    for (size_t i = 0; i < s->nConnections; i++) {
-        mpack_node_t connection = mpack_node_array_at(connections, i);
+        if (set) {
 
-        mpack_node_t type = mpack_node_map_cstr(connection, "type");
-        s->connections[i].type = mpack_node_int(type);
+            for (size_t j = 0; j < count; j++) {
+                memcpy(&buffer[j * size], (char*)values + d->indices[offset + j] * size, size);
+            }
 
-        mpack_node_t startComponent = mpack_node_map_cstr(connection, "startComponent");
-        s->connections[i].startComponent = mpack_node_u64(startComponent);
+            CHECK_STATUS(setVariable(m, variableType, &d->valueReferences[offset], count, buffer, count));
 
-        mpack_node_t endComponent = mpack_node_map_cstr(connection, "endComponent");
-        s->connections[i].endComponent = mpack_node_u64(endComponent);
+        } else {
 
-        mpack_node_t startValueReference = mpack_node_map_cstr(connection, "startValueReference");
-        s->connections[i].startValueReference = mpack_node_u32(startValueReference);
+            CHECK_STATUS(getVariable(m, variableType, &d->valueReferences[offset], count, buffer, count));
 
-        mpack_node_t endValueReference = mpack_node_map_cstr(connection, "endValueReference");
-        s->connections[i].endValueReference = mpack_node_u32(endValueReference);
+            for (size_t j = 0; j < count; j++) {
+                memcpy((char*)values + d->indices[offset + j] * size, &buffer[j * size], size);
+            }
+        }
     }
 
-    mpack_node_t variables = mpack_node_map_cstr(root, "variables");
+END:
+    return status;
+}
+
+FMIStatus getVariables(
+    System* s,
+    FMIVariableType variableType,
+    const FMIValueReference valueReferences[],
+    size_t nValueReferences,
+    void* values) {
+
+    return dispatchVariables(s, variableType, valueReferences, nValueReferences, values, false);
+}
+
+FMIStatus setVariables(
+    System* s,
+    FMIVariableType variableType,
+    const FMIValueReference valueReferences[],
+    size_t nValueReferences,
+    const void* values) {
 
-    s->nVariables = mpack_node_array_length(variables);
+    return dispatchVariables(s, variableType, valueReferences, nValueReferences, (void*)values, true);
+}
 
-    s->variables = calloc(s->nVariables, sizeof(VariableMapping));
+#define UNSCHEDULED SIZE_MAX
 
-    for (size_t i = 0; i < s->nVariables; i++) {
+// with Jacobi all connections use the values of the previous step anyway
+static bool isDelayed(const System* s, const Connection* k) {
+    return s->masterAlgorithm == GaussSeidel && k->delayed;
+}
+
+// Group the components into wavefronts that are stepped one after the other. With the
+// Jacobi algorithm all components form one wavefront and all connections are transferred
+// before the step. With Gauss-Seidel the wavefronts follow the topological order of the
+// connection graph, so a component's inputs are the outputs of the components that have
+// already been stepped. Cycles are broken by turning the incoming connections of one
+// component into feedback connections that use the values of the previous step.
+// Delayed connections always use the values of the previous step. They are transferred
+// before the first wavefront and don't constrain the order, so the components they
+// connect can be stepped concurrently.
+static bool buildSchedule(System *s) {
 
-        mpack_node_t variable = mpack_node_array_at(variables, i);
+    bool success = false;
 
-        mpack_node_t components = mpack_node_map_cstr(variable, "components");
-        mpack_node_t valueReferences = mpack_node_map_cstr(variable, "valueReferences");
-        mpack_node_t variableTypeNode = mpack_node_map_cstr(variable, "type");
-        FMIVariableType variableType = mpack_node_int(variableTypeNode);
+    size_t *wavefrontIndex = calloc(s->nComponents, sizeof(size_t));
+    size_t *nInputs = calloc(s->nComponents, sizeof(size_t));
 
-        const bool hasStartValue = mpack_node_map_contains_cstr(variable, "start");
+    s->nWavefronts = 0;
+    s->wavefronts = calloc(s->nComponents, sizeof(Wavefront));
 
-        mpack_node_t start;
+    if ((s->nComponents > 0) && (!wavefrontIndex || !nInputs || !s->wavefronts)) {
+        goto END;
+    }
 
-        if (hasStartValue) {
-            start = mpack_node_map_cstr(variable, "start");
+    for (size_t i = 0; i < s->nConnections; i++) {
+        Connection *k = &s->connections[i];
+        k->feedback = s->masterAlgorithm == GaussSeidel && (k->delayed || k->startComponent == k->endComponent);
+        if (!k->feedback) {
+            nInputs[k->endComponent]++;
         }
+    }
 
-        s->variables[i].size = mpack_node_array_length(components);
-        s->variables[i].ci = calloc(s->variables[i].size, sizeof(size_t));
-        s->variables[i].vr = calloc(s->variables[i].size, sizeof(FMIValueReference));
+    if (s->masterAlgorithm == Jacobi) {
 
-        for (size_t j = 0; j < s->variables[i].size; j++) {
+        if (s->nComponents > 0) {
+            s->nWavefronts = 1;
+        }
 
-            mpack_node_t component = mpack_node_array_at(components, j);
-            mpack_node_t valueReference = mpack_node_array_at(valueReferences, j);
+    } else {
 
-            const size_t ci = mpack_node_u64(component);
-            const FMIValueReference vr = mpack_node_u32(valueReference);
+        for (size_t i = 0; i < s->nComponents; i++) {
+            wavefrontIndex[i] = UNSCHEDULED;
+        }
 
-            if (hasStartValue) {
+        size_t nScheduled = 0;
 
-                FMIStatus status = FMIOK;
-                FMIInstance* m = s->components[ci]->instance;
+        while (nScheduled < s->nComponents) {
 
-                // TODO: Unpack start values for other FMI3 types
-                switch (variableType) {
-                case FMIRealType: {
-                    const fmi3Float64 value = mpack_node_double(start);
-                    status = setVariable(m, variableType, &vr, &value);
-                    break;
-                }
-                case FMIIntegerType: {
-                    const fmi3Int32 value = mpack_node_int(start);
-                    status = setVariable(m, variableType, &vr, &value);
-                    break;
-                }
-                case FMIInt64Type: {
-                    const fmi3Int64 value = mpack_node_int(start);
-                    status = setVariable(m, variableType, &vr, &value);
-                    break;
-                }
-                case FMIBooleanType: {
-                    const fmi3Boolean value = mpack_node_bool(start);
-                    status = setVariable(m, variableType, &vr, &value);
-                    break;
-                }
-                case FMIStringType: {
-                    const char* value = mpack_node_cstr_alloc(start, 2048);
-                    status = setVariable(m, variableType, &vr, &value);
-                    MPACK_FREE((void *) value);
-                    break;
+            const size_t w = s->nWavefronts++;
+
+            size_t next = UNSCHEDULED;
+
+            for (size_t i = 0; i < s->nComponents; i++) {
+                if (wavefrontIndex[i] == UNSCHEDULED && (next == UNSCHEDULED || nInputs[i] < nInputs[next])) {
+                    next = i;
                 }
-                default:
-                    // TODO: log this
-                    // logMessage(NULL, instanceName, fmi2Fatal, "logError", "Unknown type ID for variable index %d: %d.", j, variableType);
-                    return NULL;
-                    break;
+            }
+
+            // all remaining components are part of a cycle
+            if (nInputs[next] > 0) {
+                for (size_t i = 0; i < s->nConnections; i++) {
+                    Connection *k = &s->connections[i];
+                    if (!k->feedback && k->endComponent == next && wavefrontIndex[k->startComponent] == UNSCHEDULED) {
+                        k->feedback = true;
+                        nInputs[next]--;
+                    }
                 }
+            }
 
-                if (status > FMIWarning) {
-                    return NULL;
+            for (size_t i = 0; i < s->nComponents; i++) {
+                if (wavefrontIndex[i] == UNSCHEDULED && nInputs[i] == 0) {
+                    wavefrontIndex[i] = w;
+                    nScheduled++;
                 }
             }
 
-            s->variables[i].ci[j] = ci;
-            s->variables[i].vr[j] = vr;
+            for (size_t i = 0; i < s->nConnections; i++) {
+                Connection *k = &s->connections[i];
+                if (!k->feedback && wavefrontIndex[k->startComponent] == w) {
+                    nInputs[k->endComponent]--;
+                }
+            }
         }
-
     }
 
-    // clean up and check for errors
-    if (mpack_tree_destroy(&tree) != mpack_ok) {
-        // TODO: log this
-        // logger(NULL, instanceName, fmi2Error, "logError", "An error occurred decoding %s.", configFilename);
-        return NULL;
-    }
+    if (s->masterAlgorithm == GaussSeidel) {
 
-    return s;
-}
+        Wavefront *w = &s->delayed;
 
-FMIStatus doStep(
-    System* s,
-    double  currentCommunicationPoint,
-    double  communicationStepSize,
-    bool    noSetFMUStatePriorToCurrentPoint) {
+        for (size_t j = 0; j < s->nConnections; j++) {
+            if (s->connections[j].delayed) {
+                w->nConnections++;
+            }
+        }
 
-    FMIStatus status = FMIOK;
-    void* value = malloc(2048);
-    if (value == NULL) {
-        status = FMIError;
-        return status;
-    }
+        w->connections = calloc(w->nConnections, sizeof(Connection*));
 
-    for (size_t i = 0; i < s->nConnections; i++) {
+        if (w->nConnections > 0 && !w->connections) {
+            goto END;
+        }
 
-        Connection* k = &(s->connections[i]);
-        FMIInstance* m1 = s->components[k->startComponent]->instance;
-        FMIInstance* m2 = s->components[k->endComponent]->instance;
+        w->nConnections = 0;
 
-        CHECK_STATUS(getVariable(m1, k->type, &(k->startValueReference), value));
-        CHECK_STATUS(setVariable(m2, k->type, &(k->endValueReference), value));
+        for (size_t j = 0; j < s->nConnections; j++) {
+            if (s->connections[j].delayed) {
+                w->connections[w->nConnections++] = &s->connections[j];
+            }
+        }
     }
 
-    if (s->parallelDoStep) {
+    for (size_t i = 0; i < s->nWavefronts; i++) {
 
-        for (size_t i = 0; i < s->nComponents; i++) {
-            Component* component = s->components[i];
-#ifdef _WIN32
-            WaitForSingleObject(component->mutex, INFINITE);
-#else
-            pthread_mutex_lock(&component->mutex);
-#endif
-            component->currentCommunicationPoint = currentCommunicationPoint;
-            component->communicationStepSize = communicationStepSize;
-            component->noSetFMUStatePriorToCurrentPoint = noSetFMUStatePriorToCurrentPoint;
-            component->doStep = true;
-#ifdef _WIN32
-            ReleaseMutex(component->mutex);
-#else
-            pthread_mutex_unlock(&component->mutex);
-#endif
+        Wavefront *w = &s->wavefronts[i];
+
+        for (size_t j = 0; j < s->nComponents; j++) {
+            if (wavefrontIndex[j] == i) {
+                w->nComponents++;
+            }
         }
 
-        for (size_t i = 0; i < s->nComponents; i++) {
-            Component* component = s->components[i];
-            bool waitForThread = true;
-            FMIStatus status;
+        for (size_t j = 0; j < s->nConnections; j++) {
+            if (!isDelayed(s, &s->connections[j]) && wavefrontIndex[s->connections[j].endComponent] == i) {
+                w->nConnections++;
+            }
+        }
+
+        w->components = calloc(w->nComponents, sizeof(Component*));
+        w->connections = calloc(w->nConnections, sizeof(Connection*));
+
+        if ((w->nComponents > 0 && !w->components) || (w->nConnections > 0 && !w->connections)) {
+            goto END;
+        }
+
+        w->nComponents = 0;
+        w->nConnections = 0;
+
+        for (size_t j = 0; j < s->nComponents; j++) {
+            if (wavefrontIndex[j] == i) {
+                w->components[w->nComponents++] = s->components[j];
+            }
+        }
+
+        for (size_t j = 0; j < s->nConnections; j++) {
+            if (!isDelayed(s, &s->connections[j]) && wavefrontIndex[s->connections[j].endComponent] == i) {
+                w->connections[w->nConnections++] = &s->connections[j];
+            }
+        }
+    }
+
+    success = true;
+
+END:
+    free(wavefrontIndex);
+    free(nInputs);
+
+    return success;
+}
+
+static Transfer* findTransfer(Transfer* transfers, size_t* nTransfers, Component* component, FMIVariableType type) {
+
+    for (size_t i = 0; i < *nTransfers; i++) {
+        if (transfers[i].component == component && transfers[i].type == type) {
+            return &transfers[i];
+        }
+    }
+
+    Transfer* t = &transfers[(*nTransfers)++];
+
+    t->component = component;
+    t->type = type;
+
+    return t;
+}
+
+static bool appendValueReference(Transfer* t, FMIValueReference valueReference, size_t size, const void* source) {
+
+    FMIValueReference* valueReferences = realloc(t->valueReferences, (t->nValueReferences + 1) * sizeof(FMIValueReference));
+
+    if (!valueReferences) {
+        return false;
+    }
+
+    t->valueReferences = valueReferences;
+
+    size_t* sizes = realloc(t->sizes, (t->nValueReferences + 1) * sizeof(size_t));
+
+    if (!sizes) {
+        return false;
+    }
+
+    t->sizes = sizes;
+
+    if (source) {
+
+        const void** sources = realloc((void *)t->sources, (t->nValueReferences + 1) * sizeof(void*));
+
+        if (!sources) {
+            return false;
+        }
+
+        t->sources = sources;
+        t->sources[t->nValueReferences] = source;
+    }
+
+    t->sizes[t->nValueReferences] = size;
+    t->valueReferences[t->nValueReferences++] = valueReference;
+    t->nValues += size;
+
+    return true;
+}
+
+// Move the transfers of type Binary to the front or the back while keeping the order of the others
+static void moveBinaryTransfers(Transfer* transfers, size_t nTransfers, bool toFront) {
+
+    for (size_t i = 1; i < nTransfers; i++) {
+
+        Transfer t = transfers[i];
+        size_t j = i;
+
+        // insertion sort by (type == Binary) != toFront, which is stable
+        while (j > 0 && ((transfers[j - 1].type == FMIBinaryType) != toFront) > ((t.type == FMIBinaryType) != toFront)) {
+            transfers[j] = transfers[j - 1];
+            j--;
+        }
+
+        transfers[j] = t;
+    }
+}
+
+// Group the connections of a wavefront by (startComponent, type) and (endComponent, type),
+// so doStep() gets and sets the values of each group with a single call. Outputs that are
+// connected to several inputs are retrieved only once. Array variables are moved as a whole with
+// one bulk copy per connection.
+static bool buildTransfers(System* s, Wavefront* w) {
+
+    bool success = false;
+
+    if (w->nConnections == 0) {
+        return true;
+    }
+
+    // get transfer and offset of the values of every connection
+    Transfer** getTransfers = calloc(w->nConnections, sizeof(Transfer*));
+    size_t* getOffsets = calloc(w->nConnections, sizeof(size_t));
+
+    // there are at most as many transfers as connections
+    w->getTransfers = calloc(w->nConnections, sizeof(Transfer));
+    w->setTransfers = calloc(w->nConnections, sizeof(Transfer));
+
+    if (!getTransfers || !getOffsets || !w->getTransfers || !w->setTransfers) {
+        goto END;
+    }
+
+    for (size_t j = 0; j < w->nConnections; j++) {
+
+        const Connection* k = w->connections[j];
+
+        Transfer* t = findTransfer(w->getTransfers, &w->nGetTransfers, s->components[k->startComponent], k->type);
+
+        // within a wavefront the connections of a start component are either all feedback connections or none
+        t->feedback = k->feedback;
+
+        size_t index = 0;
+        size_t offset = 0;
+
+        while (index < t->nValueReferences && t->valueReferences[index] != k->startValueReference) {
+            offset += t->sizes[index];
+            index++;
+        }
+
+        if (index == t->nValueReferences && !appendValueReference(t, k->startValueReference, k->size, NULL)) {
+            goto END;
+        }
+
+        getTransfers[j] = t;
+        getOffsets[j] = offset;
+    }
+
+    for (size_t j = 0; j < w->nGetTransfers; j++) {
+
+        Transfer* t = &w->getTransfers[j];
+
+        t->values = calloc(t->nValues, sizeOfVariableType(t->type));
+
+        if (!t->values) {
+            goto END;
+        }
+
+        if (t->type == FMIStringType) {
+
+            t->strings = calloc(t->nValues, sizeof(char*));
+
+            if (!t->strings) {
+                goto END;
+            }
+        }
+
+        t->interpolate = t->component->interpolation == Linear && (t->type == FMIFloat32Type || t->type == FMIFloat64Type);
+
+        if (t->interpolate) {
+
+            t->samples[0] = calloc(t->nValues, sizeOfVariableType(t->type));
+            t->samples[1] = calloc(t->nValues, sizeOfVariableType(t->type));
+
+            if (!t->samples[0] || !t->samples[1]) {
+                goto END;
+            }
+        }
+
+        // connections that use the values of the previous step, except the delayed ones
+        const bool iterated = s->maxIterations > 1 && w != &s->delayed && (s->masterAlgorithm == Jacobi || t->feedback) &&
+            t->component->stepSize == 0 && t->type != FMIStringType && t->type != FMIBinaryType && t->type != FMIClockType;
+
+        if (iterated) {
+
+            t->iterates = calloc(t->nValues, sizeOfVariableType(t->type));
+
+            if (!t->iterates) {
+                goto END;
+            }
+        }
+    }
+
+    for (size_t j = 0; j < w->nConnections; j++) {
+
+        const Connection* k = w->connections[j];
+
+        Transfer* t = findTransfer(w->setTransfers, &w->nSetTransfers, s->components[k->endComponent], k->type);
+
+        const void* source = (char*)getTransfers[j]->values + getOffsets[j] * sizeOfVariableType(k->type);
+
+        if (!appendValueReference(t, k->endValueReference, k->size, source)) {
+            goto END;
+        }
+    }
+
+    for (size_t j = 0; j < w->nSetTransfers; j++) {
+
+        Transfer* t = &w->setTransfers[j];
+
+        t->values = calloc(t->nValues, sizeOfVariableType(t->type));
+
+        if (!t->values) {
+            goto END;
+        }
+    }
+
+    // the data of the binaries is passed on without copying it and is only valid until the next
+    // call to the component, so they are retrieved after the other values and set before them
+    moveBinaryTransfers(w->getTransfers, w->nGetTransfers, false);
+    moveBinaryTransfers(w->setTransfers, w->nSetTransfers, true);
+
+    success = true;
+
+END:
+    free(getTransfers);
+    free(getOffsets);
+
+    return success;
+}
+
+// Linearly interpolate the values at time between the last two samples of the source component
+static void interpolateValues(Transfer* t, double time) {
+
+    const double t0 = t->sampleTimes[0];
+    const double t1 = t->sampleTimes[1];
+
+    double w = t1 > t0 ? (time - t0) / (t1 - t0) : 1;
+
+    if (w < 0) {
+        w = 0;
+    } else if (w > 1) {
+        w = 1;
+    }
+
+    for (size_t i = 0; i < t->nValues; i++) {
+        if (t->type == FMIFloat32Type) {
+            const fmi3Float32 y0 = ((fmi3Float32*)t->samples[0])[i];
+            const fmi3Float32 y1 = ((fmi3Float32*)t->samples[1])[i];
+            ((fmi3Float32*)t->values)[i] = (fmi3Float32)(y0 + w * (y1 - y0));
+        } else {
+            const fmi3Float64 y0 = ((fmi3Float64*)t->samples[0])[i];
+            const fmi3Float64 y1 = ((fmi3Float64*)t->samples[1])[i];
+            ((fmi3Float64*)t->values)[i] = y0 + w * (y1 - y0);
+        }
+    }
+}
+
+// Activate the input clocks whose output clocks have ticked
+static FMIStatus setActiveClocks(Transfer* t) {
+
+    FMIStatus status = FMIOK;
+
+    FMIValueReference valueReferences[CONVERSION_BUFFER_SIZE];
+    fmi3Clock values[CONVERSION_BUFFER_SIZE];
+
+    size_t n = 0;
+
+    for (size_t j = 0; j < t->nValueReferences; j++) {
+
+        if (!*(const fmi3Clock*)t->sources[j]) {
+            continue;
+        }
+
+        valueReferences[n] = t->valueReferences[j];
+        values[n] = fmi3ClockActive;
+        n++;
+
+        if (n == CONVERSION_BUFFER_SIZE) {
+            CHECK_STATUS(setVariable(t->component->instance, FMIClockType, valueReferences, n, values, n));
+            n = 0;
+        }
+    }
+
+    if (n > 0) {
+        CHECK_STATUS(setVariable(t->component->instance, FMIClockType, valueReferences, n, values, n));
+    }
+
+END:
+    return status;
+}
+
+// Transfer the values over the connections of a wavefront. Clocks can only be transferred in event mode.
+static FMIStatus transferValues(System* s, Wavefront* w, double currentCommunicationPoint, double communicationStepSize, bool eventMode) {
+
+    FMIStatus status = FMIOK;
+
+    for (size_t i = 0; i < w->nGetTransfers; i++) {
+
+        Transfer* t = &w->getTransfers[i];
+        Component* c = t->component;
+
+        // the values of the iterated connections have been set by acceptIterates()
+        if (t->iterates && s->iteration > 0) {
+            continue;
+        }
+
+        if (t->type == FMIClockType && !eventMode) {
+            continue;
+        }
+
+        // components that are not at the event are not in event mode and their clocks don't tick
+        if (t->type == FMIClockType && !c->active) {
+            memset(t->values, 0, t->nValues * sizeof(fmi3Clock));
+            continue;
+        }
+
+        const double startTime = c->statistics ? wallTime() : 0;
+
+        // the outputs of a component with its own step size only change when it is stepped, but
+        // the data of binaries is only valid until the next call and clocks tick in event mode
+        const bool stepped = c->stepSize == 0 || !t->sampled || c->time != t->sampleTimes[1] ||
+            t->type == FMIBinaryType || t->type == FMIClockType;
+
+        if (stepped && t->interpolate) {
+
+            void* previous = t->samples[0];
+
+            t->samples[0] = t->samples[1];
+            t->samples[1] = previous;
+            t->sampleTimes[0] = t->sampleTimes[1];
+
+            CHECK_STATUS(getVariable(c->instance, t->type, t->valueReferences, t->nValueReferences, t->samples[1], t->nValues));
+
+            if (!t->sampled) {
+                memcpy(t->samples[0], t->samples[1], t->nValues * sizeOfVariableType(t->type));
+                t->sampleTimes[0] = c->time;
+            }
+
+        } else if (stepped) {
+
+            CHECK_STATUS(getVariable(c->instance, t->type, t->valueReferences, t->nValueReferences, t->values, t->nValues));
+
+            // the retrieved strings are only valid until the next call to the component
+            if (t->type == FMIStringType) {
+
+                fmi3String* values = (fmi3String*)t->values;
+
+                for (size_t j = 0; j < t->nValues; j++) {
+
+                    char* copy = strdup(values[j] ? values[j] : "");
+
+                    if (!copy) {
+                        status = FMIError;
+                        goto END;
+                    }
+
+                    free(t->strings[j]);
+                    t->strings[j] = copy;
+                    values[j] = copy;
+                }
+            }
+        }
+
+        if (stepped) {
+            t->sampled = true;
+            t->sampleTimes[1] = c->time;
+        }
+
+        if (t->interpolate) {
+            // with Gauss-Seidel the inputs refer to the end of the step
+            const bool endOfStep = s->masterAlgorithm == GaussSeidel && !t->feedback;
+            interpolateValues(t, endOfStep ? currentCommunicationPoint + communicationStepSize : currentCommunicationPoint);
+        }
+
+        if (c->statistics) {
+            addSample(&c->statistics->transferTime, wallTime() - startTime);
+        }
+    }
+
+    for (size_t i = 0; i < w->nSetTransfers; i++) {
+
+        Transfer* t = &w->setTransfers[i];
+
+        // components that are not stepped keep their inputs until they are
+        if (!t->component->active) {
+            continue;
+        }
+
+        if (t->type == FMIClockType) {
+
+            if (eventMode) {
+                CHECK_STATUS(setActiveClocks(t));
+            }
+
+            continue;
+        }
+
+        const double startTime = t->component->statistics ? wallTime() : 0;
+
+        const size_t size = sizeOfVariableType(t->type);
+
+        char* values = t->values;
+
+        for (size_t j = 0; j < t->nValueReferences; j++) {
+            memcpy(values, t->sources[j], t->sizes[j] * size);
+            values += t->sizes[j] * size;
+        }
+
+        CHECK_STATUS(setVariable(t->component->instance, t->type, t->valueReferences, t->nValueReferences, t->values, t->nValues));
+
+        if (t->component->statistics) {
+            addSample(&t->component->statistics->transferTime, wallTime() - startTime);
+        }
+    }
+
+END:
+    return status;
+}
+
+// Make the next transfers retrieve the outputs of all components
+static void discardSamples(System* s) {
+
+    for (size_t i = 0; i < s->nWavefronts; i++) {
+        for (size_t j = 0; j < s->wavefronts[i].nGetTransfers; j++) {
+            s->wavefronts[i].getTransfers[j].sampled = false;
+        }
+    }
+
+    for (size_t i = 0; i < s->delayed.nGetTransfers; i++) {
+        s->delayed.getTransfers[i].sampled = false;
+    }
+}
+
+static void freeTransfers(Transfer* transfers, size_t nTransfers) {
+
+    for (size_t i = 0; i < nTransfers; i++) {
+
+        Transfer* t = &transfers[i];
+
+        if (t->strings) {
+            for (size_t j = 0; j < t->nValues; j++) {
+                free(t->strings[j]);
+            }
+        }
+
+        free(t->valueReferences);
+        free(t->sizes);
+        free(t->values);
+        free((void *)t->sources);
+        free(t->strings);
+        free(t->samples[0]);
+        free(t->samples[1]);
+        free(t->iterates);
+    }
+
+    free(transfers);
+}
+
+System* instantiateSystem(
+    FMIMajorVersion fmiMajorVersion,
+    const char* resourcesDir,
+    const char* instanceName,
+    void* logMessage,
+    void* instanceEnvironment,
+    bool loggingOn,
+    bool visible) {
+
+    // instances with the same resources share the configuration and the loaded platform binaries
+    Config* config = acquireConfig(resourcesDir);
+
+    if (!config) {
+        // TODO: log this
+        // logger(NULL, instanceName, fmi2Error, "logError", "Failed to read the configuration from %s.", resourcesDir);
+        return NULL;
+    }
+
+    const ConfigHeader* header = config->header;
+
+    bool success = false;
+
+    // the start values are collected by type and set with one call per component and type
+    FMIValueReference* startValueReferences[FMIClockType + 1] = { NULL };
+    void* startValues[FMIClockType + 1] = { NULL };
+    size_t nStartValues[FMIClockType + 1] = { 0 };
+
+    System* s = calloc(1, sizeof(System));
+
+    if (!s) {
+        releaseConfig(config);
+        return NULL;
+    }
+
+    // from here on the configuration is released by freeSystem()
+    s->fmiMajorVersion = fmiMajorVersion;
+    s->instanceName = strdup(instanceName);
+    s->instanceEnvironment = instanceEnvironment;
+    s->logMessage = logMessage;
+    s->config = config;
+    s->parallelDoStep = header->parallelDoStep != 0;
+    s->statistics = header->statistics != 0;
+    s->masterAlgorithm = (MasterAlgorithm)header->masterAlgorithm;
+    s->maxIterations = header->maxIterations;
+    s->iterationTolerance = header->iterationTolerance;
+    s->nThreads = header->threads;
+    s->time = 0;
+
+    s->components = calloc(header->nComponents, sizeof(Component*));
+
+    if (!s->instanceName || !s->components) {
+        goto END;
+    }
+
+    s->nComponents = header->nComponents;
+
+    for (size_t i = 0; i < s->nComponents; i++) {
+
+        Component* c = calloc(1, sizeof(Component));
+
+        if (!c) {
+            goto END;
+        }
+
+        s->components[i] = c;
+
+        const ConfigComponent* component = &config->components[i];
+
+        const char* _name = configString(config, component->name);
+        const char* _componentFmiVersion = configString(config, component->fmiVersion);
+        const char* _guid = configString(config, component->guid);
+        const char* _modelIdentifier = configString(config, component->modelIdentifier);
+
+        FMIMajorVersion componentFmiMajorVersion;
+        if (*_componentFmiVersion == '2') {
+            componentFmiMajorVersion = FMIMajorVersion2;
+        } else if (*_componentFmiVersion == '3') {
+            componentFmiMajorVersion = FMIMajorVersion3;
+        } else {
+            goto END;
+        }
+
+        char unzipdir[4069] = "";
+        char componentResourcesDir[4069] = "";
 
-            while (waitForThread) {
-#ifdef _WIN32
-                WaitForSingleObject(component->mutex, INFINITE);
-#else
-                pthread_mutex_lock(&component->mutex);
-#endif
-                waitForThread = component->doStep;
-                status = status > component->status ? status : component->status;
 #ifdef _WIN32
-                ReleaseMutex(component->mutex);
+        PathCombine(unzipdir, resourcesDir, _modelIdentifier);
+        PathCombine(componentResourcesDir, unzipdir, "resources");
 #else
-                pthread_mutex_unlock(&component->mutex);
+        sprintf(unzipdir, "%s/%s", resourcesDir, _modelIdentifier);
+        sprintf(componentResourcesDir, "%s/%s", unzipdir, "resources");
 #endif
+        char componentResourcesUri[4069] = "";
+
+        FMIPathToURI(componentResourcesDir, componentResourcesUri, 4096);
+
+        char libraryPath[4069] = "";
+
+        switch (componentFmiMajorVersion) {
+        case FMIMajorVersion2:
+            FMIPlatformBinaryPath(unzipdir, _modelIdentifier, FMIMajorVersion2, libraryPath, 4096);
+            break;
+        case FMIMajorVersion3:
+            FMIPlatformBinaryPath(unzipdir, _modelIdentifier, FMIMajorVersion3, libraryPath, 4096);
+            break;
+        default:
+            break;
+        }
+
+        FMIInstance* m = FMICreateInstance(_name, logFMIMessage, loggingOn ? logFunctionCall : NULL);
+
+        if (!m) {
+            goto END;
+        }
+
+        c->instance = m;
+
+        m->userData = s;
+
+        if (FMILoadPlatformBinary(m, libraryPath) != FMIOK) {
+            logSystemMessage(s, FMIError, "logError", "Failed to load the platform binary %s.", libraryPath);
+            goto END;
+        }
+
+        retainLibrary(config, i, libraryPath);
+
+        c->eventModeUsed = componentFmiMajorVersion == FMIMajorVersion3 && (component->flags & CONFIG_EVENT_MODE_USED);
+        c->earlyReturnAllowed = c->eventModeUsed && (component->flags & CONFIG_EARLY_RETURN_ALLOWED);
+        c->canGetAndSetFMUState = (component->flags & CONFIG_CAN_GET_AND_SET_FMU_STATE) != 0;
+
+        switch (componentFmiMajorVersion) {
+        case FMIMajorVersion2:
+            if (FMI2Instantiate(m, componentResourcesDir, fmi2CoSimulation, _guid, visible, loggingOn) > FMIWarning) {
+                goto END;
+            }
+            break;
+        case FMIMajorVersion3:
+            if (FMI3InstantiateCoSimulation(m, _guid, componentResourcesDir, visible, loggingOn, c->eventModeUsed, c->earlyReturnAllowed, NULL, 0, NULL ) > FMIWarning) {
+                goto END;
+            }
+            break;
+        default:
+            break;
+        }
+
+        c->stepSize = component->stepSize;
+        c->interpolation = (Interpolation)component->interpolation;
+
+        if (s->statistics) {
+
+            c->statistics = calloc(1, sizeof(ComponentStatistics));
+
+            if (!c->statistics) {
+                goto END;
+            }
+        }
+    }
+
+    // the components can only be rolled back to an event if all of them can set their state
+    for (size_t i = 0; i < s->nComponents; i++) {
+
+        if (!s->components[i]->canGetAndSetFMUState) {
+            s->rollBackToEvents = false;
+            break;
+        }
+
+        if (s->components[i]->earlyReturnAllowed) {
+            s->rollBackToEvents = true;
+        }
+    }
+
+    if (s->parallelDoStep) {
+
+        // by default use one thread per component but not more than there are processors
+        if (s->nThreads == 0) {
+            const size_t nProcessors = numberOfProcessors();
+            s->nThreads = s->nComponents < nProcessors ? s->nComponents : nProcessors;
+        }
+
+        s->threadPool = createThreadPool(s->nThreads);
+
+        if (!s->threadPool) {
+            goto END;
+        }
+    }
+
+    s->connections = calloc(header->nConnections, sizeof(Connection));
+
+    if (!s->connections && header->nConnections > 0) {
+        goto END;
+    }
+
+    s->nConnections = header->nConnections;
+
+    for (size_t i = 0; i < s->nConnections; i++) {
+
+        const ConfigConnection* connection = &config->connections[i];
+
+        s->connections[i].type = (FMIVariableType)connection->type;
+        s->connections[i].startComponent = connection->startComponent;
+        s->connections[i].endComponent = connection->endComponent;
+        s->connections[i].startValueReference = connection->startValueReference;
+        s->connections[i].endValueReference = connection->endValueReference;
+        s->connections[i].size = connection->size;
+        s->connections[i].delayed = connection->delayed != 0;
+
+        // arrays are only supported by FMI 3.0 and the binaries and clocks are transferred element-wise
+        if (connection->size > 1 && (connection->type == FMIBinaryType || connection->type == FMIClockType ||
+            s->components[connection->startComponent]->instance->fmiMajorVersion != FMIMajorVersion3 ||
+            s->components[connection->endComponent]->instance->fmiMajorVersion != FMIMajorVersion3)) {
+            logSystemMessage(s, FMIError, "logError", "Connection %zu connects arrays of an unsupported type or of an FMI 2.0 component.", i);
+            goto END;
+        }
+    }
+
+    if (!buildSchedule(s) || !buildTransfers(s, &s->delayed)) {
+        goto END;
+    }
+
+    for (size_t i = 0; i < s->nWavefronts; i++) {
+        if (!buildTransfers(s, &s->wavefronts[i])) {
+            goto END;
+        }
+    }
+
+    s->variables = calloc(header->nVariables, sizeof(VariableMapping));
+
+    if (!s->variables && header->nVariables > 0) {
+        goto END;
+    }
+
+    s->nVariables = header->nVariables;
+
+    for (size_t i = 0; i < s->nVariables; i++) {
+
+        const ConfigVariable* variable = &config->variables[i];
+
+        FMIVariableType variableType = (FMIVariableType)variable->type;
+
+        s->variables[i].size = variable->nMappings;
+        s->variables[i].ci = calloc(s->variables[i].size, sizeof(size_t));
+        s->variables[i].vr = calloc(s->variables[i].size, sizeof(FMIValueReference));
+
+        if (s->variables[i].size > 0 && (!s->variables[i].ci || !s->variables[i].vr)) {
+            goto END;
+        }
+
+        for (size_t j = 0; j < s->variables[i].size; j++) {
+
+            const ConfigMapping* mapping = &config->mappings[variable->mappings + j];
+
+            s->variables[i].ci[j] = mapping->component;
+            s->variables[i].vr[j] = mapping->valueReference;
+        }
+
+        if (!variable->hasStart) {
+            continue;
+        }
+
+        if (variableType > FMIClockType) {
+            goto END;
+        }
+
+        if (!startValues[variableType]) {
+
+            startValueReferences[variableType] = calloc(s->nVariables, sizeof(FMIValueReference));
+            startValues[variableType] = calloc(s->nVariables, sizeOfVariableType(variableType));
+
+            if (!startValueReferences[variableType] || !startValues[variableType]) {
+                goto END;
+            }
+        }
+
+        void* value = (char*)startValues[variableType] + nStartValues[variableType] * sizeOfVariableType(variableType);
+
+        switch (variableType) {
+        case FMIFloat32Type:
+            *(fmi3Float32*)value = (fmi3Float32)variable->start.float64;
+            break;
+        case FMIFloat64Type:
+            *(fmi3Float64*)value = variable->start.float64;
+            break;
+        case FMIInt8Type:
+            *(fmi3Int8*)value = (fmi3Int8)variable->start.int64;
+            break;
+        case FMIUInt8Type:
+            *(fmi3UInt8*)value = (fmi3UInt8)variable->start.uint64;
+            break;
+        case FMIInt16Type:
+            *(fmi3Int16*)value = (fmi3Int16)variable->start.int64;
+            break;
+        case FMIUInt16Type:
+            *(fmi3UInt16*)value = (fmi3UInt16)variable->start.uint64;
+            break;
+        case FMIInt32Type:
+            *(fmi3Int32*)value = (fmi3Int32)variable->start.int64;
+            break;
+        case FMIUInt32Type:
+            *(fmi3UInt32*)value = (fmi3UInt32)variable->start.uint64;
+            break;
+        case FMIInt64Type:
+            *(fmi3Int64*)value = variable->start.int64;
+            break;
+        case FMIUInt64Type:
+            *(fmi3UInt64*)value = variable->start.uint64;
+            break;
+        case FMIBooleanType:
+            *(fmi3Boolean*)value = variable->start.int64 != 0;
+            break;
+        case FMIStringType:
+            // the strings remain valid as long as the configuration
+            *(const char**)value = configString(config, variable->start.string);
+            break;
+        case FMIBinaryType:
+            ((BinaryValue*)value)->data = configBinary(config, variable->start.binary, &((BinaryValue*)value)->size);
+            break;
+        default:
+            // clocks have no start values
+            // TODO: log this
+            // logMessage(NULL, instanceName, fmi2Fatal, "logError", "Unknown type ID for variable index %d: %d.", j, variableType);
+            goto END;
+        }
+
+        startValueReferences[variableType][nStartValues[variableType]++] = (FMIValueReference)(i + 1);
+    }
+
+    for (FMIVariableType type = 0; type <= FMIClockType; type++) {
+        if (nStartValues[type] > 0 && setVariables(s, type, startValueReferences[type], nStartValues[type], startValues[type]) > FMIWarning) {
+            goto END;
+        }
+    }
+
+    success = true;
+
+END:
+    for (FMIVariableType type = 0; type <= FMIClockType; type++) {
+        free(startValueReferences[type]);
+        free(startValues[type]);
+    }
+
+    if (!success) {
+        // a partly instantiated system has no statistics to report
+        s->statistics = false;
+        freeSystem(s);
+        return NULL;
+    }
+
+    return s;
+}
+
+void setStartTime(System* s, double startTime) {
+
+    s->time = startTime;
+
+    for (size_t i = 0; i < s->nComponents; i++) {
+        s->components[i]->time = startTime;
+    }
+}
+
+static FMIStatus stepWavefronts(System* s, double currentCommunicationPoint, double communicationStepSize) {
+
+    FMIStatus status = FMIOK;
+
+    for (size_t i = 0; i < s->nWavefronts; i++) {
+
+        Wavefront* w = &s->wavefronts[i];
+
+        CHECK_STATUS(transferValues(s, w, currentCommunicationPoint, communicationStepSize, false));
+
+        if (s->parallelDoStep) {
+
+            runThreadPool(s->threadPool, doStepTask, w, w->nComponents);
+
+            const double endTime = s->statistics ? wallTime() : 0;
+
+            for (size_t j = 0; j < w->nComponents; j++) {
+
+                Component* c = w->components[j];
+
+                if (c->statistics && c->active) {
+                    addSample(&c->statistics->waitTime, endTime - c->stepEndTime);
+                }
+
+                if (c->status > status) {
+                    status = c->status;
+                }
+            }
+
+            if (status > FMIWarning) {
+                goto END;
+            }
+
+        } else {
+
+            for (size_t j = 0; j < w->nComponents; j++) {
+                if (w->components[j]->active) {
+                    CHECK_STATUS(componentDoStep(w->components[j]));
+                }
+            }
+
+        }
+    }
+
+END:
+    return status;
+}
+
+static bool valuesConverged(const Transfer* t, double tolerance) {
+
+    const size_t size = sizeOfVariableType(t->type);
+
+    for (size_t i = 0; i < t->nValues; i++) {
+
+        double a, b;
+
+        switch (t->type) {
+        case FMIFloat32Type:
+            a = ((fmi3Float32*)t->values)[i];
+            b = ((fmi3Float32*)t->iterates)[i];
+            break;
+        case FMIFloat64Type:
+            a = ((fmi3Float64*)t->values)[i];
+            b = ((fmi3Float64*)t->iterates)[i];
+            break;
+        default:
+            if (memcmp((char*)t->values + i * size, (char*)t->iterates + i * size, size)) {
+                return false;
+            }
+            continue;
+        }
+
+        if (fabs(b - a) > tolerance * (1.0 + fabs(b))) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Retrieve the outputs of the iterated connections at the end of the step and
+// check if they match the inputs that have been used for the step
+static FMIStatus checkConvergence(System* s, bool* converged) {
+
+    FMIStatus status = FMIOK;
+
+    *converged = true;
+
+    for (size_t i = 0; i < s->nWavefronts; i++) {
+
+        Wavefront* w = &s->wavefronts[i];
+
+        for (size_t j = 0; j < w->nGetTransfers; j++) {
+
+            Transfer* t = &w->getTransfers[j];
+
+            if (!t->iterates) {
+                continue;
+            }
+
+            CHECK_STATUS(getVariable(t->component->instance, t->type, t->valueReferences, t->nValueReferences, t->iterates, t->nValues));
+
+            if (*converged && !valuesConverged(t, s->iterationTolerance)) {
+                *converged = false;
+            }
+        }
+    }
+
+END:
+    return status;
+}
+
+// Use the outputs at the end of the step as inputs for the next iteration
+static void acceptIterates(System* s) {
+
+    for (size_t i = 0; i < s->nWavefronts; i++) {
+
+        Wavefront* w = &s->wavefronts[i];
+
+        for (size_t j = 0; j < w->nGetTransfers; j++) {
+
+            Transfer* t = &w->getTransfers[j];
+
+            if (t->iterates) {
+                memcpy(t->values, t->iterates, t->nValues * sizeOfVariableType(t->type));
+            }
+        }
+    }
+}
+
+// Set the communication interval of the components for a pass of doStep() that starts at
+// currentCommunicationPoint and ends at stopTime
+static void prepareComponents(System* s, double currentCommunicationPoint, double communicationStepSize, double stopTime, bool noSetFMUStatePriorToCurrentPoint) {
+
+    const bool iterate = s->maxIterations > 1;
+
+    for (size_t i = 0; i < s->nComponents; i++) {
+
+        Component* component = s->components[i];
+
+        if (component->stepSize > communicationStepSize) {
+            // a component with a larger step size steps ahead once the container has caught up with it
+            component->active = component->time <= currentCommunicationPoint + EPSILON(currentCommunicationPoint);
+            component->currentCommunicationPoint = component->time;
+            component->communicationStepSize = component->stepSize;
+        } else {
+            // components that have stopped at an event continue from there
+            component->active = component->time < stopTime - EPSILON(stopTime);
+            component->currentCommunicationPoint = component->time;
+            component->communicationStepSize = stopTime - component->time;
+        }
+
+        // the iteration and the roll back to events restore the state at the current communication point
+        component->noSetFMUStatePriorToCurrentPoint = noSetFMUStatePriorToCurrentPoint && !iterate && !s->rollBackToEvents;
+    }
+}
+
+// Step the active components from currentCommunicationPoint to stopTime
+static FMIStatus stepSystem(System* s, double currentCommunicationPoint, double communicationStepSize, double stopTime, bool noSetFMUStatePriorToCurrentPoint) {
+
+    FMIStatus status = FMIOK;
+
+    const double h = stopTime - currentCommunicationPoint;
+
+    prepareComponents(s, currentCommunicationPoint, communicationStepSize, stopTime, noSetFMUStatePriorToCurrentPoint);
+
+    CHECK_STATUS(transferValues(s, &s->delayed, currentCommunicationPoint, h, false));
+
+    if (s->maxIterations <= 1) {
+        CHECK_STATUS(stepWavefronts(s, currentCommunicationPoint, h));
+        goto END;
+    }
+
+    CHECK_STATUS(getSystemState(s, &s->iterationState));
+
+    bool converged = false;
+
+    for (s->iteration = 0; s->iteration < s->maxIterations; s->iteration++) {
+
+        if (s->iteration > 0) {
+            CHECK_STATUS(setSystemState(s, s->iterationState));
+            acceptIterates(s);
+        }
+
+        FMIStatus stepStatus = stepWavefronts(s, currentCommunicationPoint, h);
+
+        if (stepStatus > FMIWarning) {
+            status = stepStatus;
+            goto END;
+        }
+
+        CHECK_STATUS(checkConvergence(s, &converged));
+
+        if (converged) {
+            break;
+        }
+    }
+
+    if (!converged) {
+        logSystemMessage(s, FMIWarning, "logStatusWarning", "The iteration did not converge in %zu iterations at t=%g.", s->maxIterations, currentCommunicationPoint);
+        status = FMIWarning;
+    }
+
+END:
+    s->iteration = 0;
+
+    return status;
+}
+
+// Get the earliest time at which a component has stopped at an event before stopTime
+static bool earliestEvent(System* s, double stopTime, double* eventTime) {
+
+    bool found = false;
+
+    for (size_t i = 0; i < s->nComponents; i++) {
+
+        const Component* c = s->components[i];
+
+        if (!c->active || !(c->earlyReturn || c->eventHandlingNeeded) || c->time >= stopTime - EPSILON(stopTime)) {
+            continue;
+        }
+
+        if (!found || c->time < *eventTime) {
+            *eventTime = c->time;
+            found = true;
+        }
+    }
+
+    return found;
+}
+
+// Let the components that have stopped at time update their discrete states together. The
+// values are transferred between the components until none of them needs another update.
+static FMIStatus handleEvents(System* s, double time) {
+
+    FMIStatus status = FMIOK;
+
+    bool eventHandlingNeeded = false;
+
+    for (size_t i = 0; i < s->nComponents; i++) {
+
+        Component* c = s->components[i];
+
+        // only the components at the event take part in the event iteration
+        c->active = c->eventModeUsed && fabs(c->time - time) <= EPSILON(time);
+
+        eventHandlingNeeded |= c->active && c->eventHandlingNeeded;
+    }
+
+    if (!eventHandlingNeeded) {
+        return FMIOK;
+    }
+
+    for (size_t i = 0; i < s->nComponents; i++) {
+        if (s->components[i]->active) {
+            CHECK_STATUS(FMI3EnterEventMode(s->components[i]->instance));
+        }
+    }
+
+    bool discreteStatesNeedUpdate = true;
+
+    for (size_t iteration = 0; iteration < MAX_EVENT_ITERATIONS && discreteStatesNeedUpdate; iteration++) {
+
+        discreteStatesNeedUpdate = false;
+
+        for (size_t i = 0; i < s->nWavefronts; i++) {
+            CHECK_STATUS(transferValues(s, &s->wavefronts[i], time, 0, true));
+        }
+
+        for (size_t i = 0; i < s->nComponents; i++) {
+
+            Component* c = s->components[i];
+
+            if (!c->active) {
+                continue;
+            }
+
+            fmi3Boolean needsUpdate = fmi3False;
+            fmi3Boolean terminateSimulation = fmi3False;
+            fmi3Boolean nominalsOfContinuousStatesChanged = fmi3False;
+            fmi3Boolean valuesOfContinuousStatesChanged = fmi3False;
+            fmi3Boolean nextEventTimeDefined = fmi3False;
+            fmi3Float64 nextEventTime = 0;
+
+            CHECK_STATUS(FMI3UpdateDiscreteStates(c->instance, &needsUpdate, &terminateSimulation, &nominalsOfContinuousStatesChanged, &valuesOfContinuousStatesChanged, &nextEventTimeDefined, &nextEventTime));
+
+            discreteStatesNeedUpdate |= needsUpdate;
+            c->terminateSimulation |= terminateSimulation;
+        }
+    }
+
+    if (discreteStatesNeedUpdate) {
+        logSystemMessage(s, FMIWarning, "logStatusWarning", "The event iteration did not converge in %d iterations at t=%g.", MAX_EVENT_ITERATIONS, time);
+        status = FMIWarning;
+    }
+
+    for (size_t i = 0; i < s->nComponents; i++) {
+
+        Component* c = s->components[i];
+
+        if (c->active) {
+            CHECK_STATUS(FMI3EnterStepMode(c->instance));
+            c->eventHandlingNeeded = false;
+        }
+    }
+
+END:
+    return status;
+}
+
+FMIStatus doStep(
+    System* s,
+    double  currentCommunicationPoint,
+    double  communicationStepSize,
+    bool    noSetFMUStatePriorToCurrentPoint) {
+
+    FMIStatus status = FMIOK;
+    FMIStatus stepStatus = FMIOK;
+
+    const double startTime = s->statistics ? wallTime() : 0;
+
+    const double stopTime = currentCommunicationPoint + communicationStepSize;
+
+    double time = currentCommunicationPoint;
+
+    s->earlyReturn = false;
+    s->terminateSimulation = false;
+
+    // when a component stops at an event the others are rolled back to it (if they can) and the
+    // event is handled before the components continue to the end of the step
+    while (time < stopTime - EPSILON(stopTime) && !s->terminateSimulation) {
+
+        if (s->rollBackToEvents) {
+            CHECK_STATUS(getSystemState(s, &s->eventState));
+        }
+
+        CHECK_STATUS(stepSystem(s, time, communicationStepSize, stopTime, noSetFMUStatePriorToCurrentPoint));
+        stepStatus = status > stepStatus ? status : stepStatus;
+
+        double eventTime;
+
+        if (!earliestEvent(s, stopTime, &eventTime)) {
+            time = stopTime;
+            break;
+        }
+
+        if (s->rollBackToEvents) {
+
+            for (size_t i = 0; i < s->nComponents; i++) {
+                Component* c = s->components[i];
+                c->stoppedAtEvent = c->active && (c->earlyReturn || c->eventHandlingNeeded) && fabs(c->time - eventTime) <= EPSILON(eventTime);
+            }
+
+            CHECK_STATUS(setSystemState(s, s->eventState));
+            CHECK_STATUS(stepSystem(s, time, communicationStepSize, eventTime, noSetFMUStatePriorToCurrentPoint));
+            stepStatus = status > stepStatus ? status : stepStatus;
+
+            // a component that now ends its step at the event might not report it again
+            for (size_t i = 0; i < s->nComponents; i++) {
+                s->components[i]->eventHandlingNeeded |= s->components[i]->stoppedAtEvent;
+            }
+        }
+
+        CHECK_STATUS(handleEvents(s, eventTime));
+        stepStatus = status > stepStatus ? status : stepStatus;
+
+        for (size_t i = 0; i < s->nComponents; i++) {
+            s->terminateSimulation |= s->components[i]->terminateSimulation;
+        }
+
+        time = eventTime;
+
+        // all components are at the event, so the container can return early
+        if (s->rollBackToEvents && s->earlyReturnAllowed) {
+            s->earlyReturn = true;
+            break;
+        }
+    }
+
+    if (!s->earlyReturn) {
+        CHECK_STATUS(handleEvents(s, stopTime));
+        stepStatus = status > stepStatus ? status : stepStatus;
+    }
+
+    for (size_t i = 0; i < s->nComponents; i++) {
+        s->terminateSimulation |= s->components[i]->terminateSimulation;
+    }
+
+    s->time = time;
+    s->lastSuccessfulTime = time;
+
+    status = stepStatus;
+
+END:
+    if (s->statistics) {
+        addSample(&s->doStepTime, wallTime() - startTime);
+    }
+
+    return status;
+}
+
+FMIStatus terminateSystem(System* s) {
+
+    FMIStatus status = FMIOK;
+
+    for (size_t i = 0; i < s->nComponents; i++) {
+
+        Component* component = s->components[i];
+
+        switch (component->instance->fmiMajorVersion) {
+        case FMIMajorVersion2:
+            CHECK_STATUS(FMI2Terminate(component->instance));
+            break;
+        case FMIMajorVersion3:
+            CHECK_STATUS(FMI3Terminate(component->instance));
+            break;
+        default:
+            break;
+        }
+    }
+
+END:
+    return status;
+}
+
+FMIStatus resetSystem(System* s) {
+
+    FMIStatus status = FMIOK;
+
+    setStartTime(s, 0);
+
+    discardSamples(s);
+
+    for (size_t i = 0; i < s->nComponents; i++) {
+
+        FMIInstance* m = s->components[i]->instance;
+
+        switch (m->fmiMajorVersion) {
+        case FMIMajorVersion2:
+            CHECK_STATUS(FMI2Reset(m));
+            break;
+        case FMIMajorVersion3:
+            CHECK_STATUS(FMI3Reset(m));
+            break;
+        default:
+            break;
+        }
+    }
+END:
+    return status;
+}
+
+static FMIStatus getComponentState(Component* c, void** state) {
+
+    switch (c->instance->fmiMajorVersion) {
+    case FMIMajorVersion2:
+        return FMI2GetFMUstate(c->instance, state);
+    case FMIMajorVersion3:
+        return FMI3GetFMUState(c->instance, state);
+    default:
+        return FMIError;
+    }
+}
+
+static FMIStatus setComponentState(Component* c, void* state) {
+
+    switch (c->instance->fmiMajorVersion) {
+    case FMIMajorVersion2:
+        return FMI2SetFMUstate(c->instance, state);
+    case FMIMajorVersion3:
+        return FMI3SetFMUState(c->instance, state);
+    default:
+        return FMIError;
+    }
+}
+
+static FMIStatus freeComponentState(Component* c, void** state) {
+
+    switch (c->instance->fmiMajorVersion) {
+    case FMIMajorVersion2:
+        return FMI2FreeFMUstate(c->instance, state);
+    case FMIMajorVersion3:
+        return FMI3FreeFMUState(c->instance, state);
+    default:
+        return FMIError;
+    }
+}
+
+static FMIStatus serializedComponentStateSize(Component* c, void* state, size_t* size) {
+
+    switch (c->instance->fmiMajorVersion) {
+    case FMIMajorVersion2:
+        return FMI2SerializedFMUstateSize(c->instance, state, size);
+    case FMIMajorVersion3:
+        return FMI3SerializedFMUStateSize(c->instance, state, size);
+    default:
+        return FMIError;
+    }
+}
+
+static FMIStatus serializeComponentState(Component* c, void* state, char serializedState[], size_t size) {
+
+    switch (c->instance->fmiMajorVersion) {
+    case FMIMajorVersion2:
+        return FMI2SerializeFMUstate(c->instance, state, (fmi2Byte*)serializedState, size);
+    case FMIMajorVersion3:
+        return FMI3SerializeFMUState(c->instance, state, (fmi3Byte*)serializedState, size);
+    default:
+        return FMIError;
+    }
+}
+
+static FMIStatus deserializeComponentState(Component* c, const char serializedState[], size_t size, void** state) {
+
+    switch (c->instance->fmiMajorVersion) {
+    case FMIMajorVersion2:
+        return FMI2DeSerializeFMUstate(c->instance, (const fmi2Byte*)serializedState, size, state);
+    case FMIMajorVersion3:
+        return FMI3DeserializeFMUState(c->instance, (const fmi3Byte*)serializedState, size, state);
+    default:
+        return FMIError;
+    }
+}
+
+// Copy the values in the get transfers to (save = true) or from the buffer and return the number
+// of bytes. Strings are not copied but retrieved again after the state has been restored.
+static size_t copyTransferBytes(System* s, char* buffer, bool save) {
+
+    size_t size = 0;
+
+#define COPY_BYTES(P, N) \
+    if (buffer && save) memcpy(&buffer[size], P, N); \
+    if (buffer && !save) memcpy(P, &buffer[size], N); \
+    size += N
+
+    for (size_t i = 0; i <= s->nWavefronts; i++) {
+
+        Wavefront* w = i < s->nWavefronts ? &s->wavefronts[i] : &s->delayed;
+
+        for (size_t j = 0; j < w->nGetTransfers; j++) {
+
+            Transfer* t = &w->getTransfers[j];
+
+            if (t->type == FMIStringType || t->type == FMIBinaryType) {
+                if (buffer && !save) {
+                    t->sampled = false;
+                }
+                continue;
             }
 
-            CHECK_STATUS(status);
+            const size_t n = t->nValues * sizeOfVariableType(t->type);
+
+            COPY_BYTES(&t->sampled, sizeof(t->sampled));
+            COPY_BYTES(t->sampleTimes, sizeof(t->sampleTimes));
+            COPY_BYTES(t->values, n);
+
+            if (t->interpolate) {
+                COPY_BYTES(t->samples[0], n);
+                COPY_BYTES(t->samples[1], n);
+            }
         }
+    }
 
+#undef COPY_BYTES
+
+    return size;
+}
+
+static SystemState* allocateSystemState(System* s) {
+
+    SystemState* state = calloc(1, sizeof(SystemState));
+
+    if (!state) {
+        return NULL;
     }
-    else {
 
-        for (size_t i = 0; i < s->nComponents; i++) {
+    state->componentTimes = calloc(s->nComponents, sizeof(double));
+    state->componentStates = calloc(s->nComponents, sizeof(void*));
+    state->nTransferBytes = copyTransferBytes(s, NULL, true);
+    state->transferBytes = calloc(state->nTransferBytes, 1);
 
-            FMIInstance* m = s->components[i]->instance;
+    if ((s->nComponents > 0 && (!state->componentTimes || !state->componentStates)) || (state->nTransferBytes > 0 && !state->transferBytes)) {
+        free(state->componentTimes);
+        free(state->componentStates);
+        free(state->transferBytes);
+        free(state);
+        return NULL;
+    }
 
-            switch (m->fmiMajorVersion) {
-            case FMIMajorVersion2:
-                CHECK_STATUS(FMI2DoStep(m, currentCommunicationPoint, communicationStepSize, noSetFMUStatePriorToCurrentPoint));
-                break;
-            case FMIMajorVersion3: ;
-                fmi3Boolean eventHandlingNeeded;
-                fmi3Boolean terminateSimulation;
-                fmi3Boolean earlyReturn;
-                fmi3Float64 lastSuccessfulTime;
+    return state;
+}
 
-                CHECK_STATUS(FMI3DoStep(m, currentCommunicationPoint, communicationStepSize, noSetFMUStatePriorToCurrentPoint, &eventHandlingNeeded, &terminateSimulation, &earlyReturn, &lastSuccessfulTime));
-                break;
-            default:
-                break;
-            }
+FMIStatus getSystemState(System* s, SystemState** state) {
+
+    FMIStatus status = FMIOK;
+
+    // an existing state is overwritten
+    if (!*state) {
+
+        *state = allocateSystemState(s);
+
+        if (!*state) {
+            return FMIError;
         }
+    }
+
+    SystemState* st = *state;
 
+    st->time = s->time;
+
+    for (size_t i = 0; i < s->nComponents; i++) {
+        st->componentTimes[i] = s->components[i]->time;
+        CHECK_STATUS(getComponentState(s->components[i], &st->componentStates[i]));
     }
 
+    copyTransferBytes(s, st->transferBytes, true);
+
 END:
-    free(value);
     return status;
 }
 
-FMIStatus terminateSystem(System* s) {
+FMIStatus setSystemState(System* s, const SystemState* state) {
 
     FMIStatus status = FMIOK;
 
+    if (!state) {
+        return FMIError;
+    }
+
     for (size_t i = 0; i < s->nComponents; i++) {
+        CHECK_STATUS(setComponentState(s->components[i], state->componentStates[i]));
+        s->components[i]->time = state->componentTimes[i];
+    }
 
-        Component* component = s->components[i];
+    s->time = state->time;
 
-        switch (component->instance->fmiMajorVersion) {
-        case FMIMajorVersion2:
-            CHECK_STATUS(FMI2Terminate(component->instance));
-            break;
-        case FMIMajorVersion3:
-            CHECK_STATUS(FMI3Terminate(component->instance));
-            break;
-        default:
-            break;
+    copyTransferBytes(s, state->transferBytes, false);
+
+END:
+    return status;
+}
+
+FMIStatus freeSystemState(System* s, SystemState** state) {
+
+    FMIStatus status = FMIOK;
+
+    if (!state || !*state) {
+        return status;
+    }
+
+    SystemState* st = *state;
+
+    for (size_t i = 0; i < s->nComponents; i++) {
+
+        if (!st->componentStates[i]) {
+            continue;
         }
 
-        if (s->parallelDoStep) {
-#ifdef _WIN32
-            WaitForSingleObject(component->mutex, INFINITE);
-            component->terminate = true;
-            ReleaseMutex(component->mutex);
-            WaitForSingleObject(component->thread, INFINITE);
-#else
-            pthread_mutex_lock(&component->mutex);
-            component->terminate = true;
-            pthread_mutex_unlock(&component->mutex);
-            pthread_join(component->thread, NULL);
-#endif
+        const FMIStatus componentStatus = freeComponentState(s->components[i], &st->componentStates[i]);
+
+        if (componentStatus > status) {
+            status = componentStatus;
+        }
+    }
+
+    free(st->componentTimes);
+    free(st->componentStates);
+    free(st->transferBytes);
+    free(st);
+
+    *state = NULL;
+
+    return status;
+}
+
+// The serialized state consists of the time, the time, size and serialized
+// FMU state of every component, and the number and values of the transfer bytes.
+
+FMIStatus serializedSystemStateSize(System* s, const SystemState* state, size_t* size) {
+
+    FMIStatus status = FMIOK;
+
+    if (!state) {
+        return FMIError;
+    }
+
+    *size = sizeof(double) + s->nComponents * (sizeof(double) + sizeof(size_t)) + sizeof(size_t) + state->nTransferBytes;
+
+    for (size_t i = 0; i < s->nComponents; i++) {
+
+        size_t componentSize;
+
+        CHECK_STATUS(serializedComponentStateSize(s->components[i], state->componentStates[i], &componentSize));
+
+        *size += componentSize;
+    }
+
+END:
+    return status;
+}
+
+#define WRITE_BYTES(P, N) \
+    if (position + (N) > size) { status = FMIError; goto END; } \
+    memcpy(&serializedState[position], P, N); \
+    position += N
+
+FMIStatus serializeSystemState(System* s, const SystemState* state, char serializedState[], size_t size) {
+
+    FMIStatus status = FMIOK;
+
+    size_t position = 0;
+
+    if (!state) {
+        return FMIError;
+    }
+
+    WRITE_BYTES(&state->time, sizeof(double));
+
+    for (size_t i = 0; i < s->nComponents; i++) {
+
+        size_t componentSize;
+
+        CHECK_STATUS(serializedComponentStateSize(s->components[i], state->componentStates[i], &componentSize));
+
+        WRITE_BYTES(&state->componentTimes[i], sizeof(double));
+        WRITE_BYTES(&componentSize, sizeof(size_t));
+
+        if (position + componentSize > size) {
+            status = FMIError;
+            goto END;
         }
+
+        CHECK_STATUS(serializeComponentState(s->components[i], state->componentStates[i], &serializedState[position], componentSize));
+
+        position += componentSize;
     }
 
+    WRITE_BYTES(&state->nTransferBytes, sizeof(size_t));
+    WRITE_BYTES(state->transferBytes, state->nTransferBytes);
+
 END:
     return status;
 }
 
-FMIStatus resetSystem(System* s) {
+#undef WRITE_BYTES
+
+#define READ_BYTES(P, N) \
+    if (position + (N) > size) { status = FMIError; goto END; } \
+    memcpy(P, &serializedState[position], N); \
+    position += N
+
+FMIStatus deserializeSystemState(System* s, const char serializedState[], size_t size, SystemState** state) {
 
     FMIStatus status = FMIOK;
 
-    s->time = 0;
+    size_t position = 0;
+
+    SystemState* st = allocateSystemState(s);
+
+    if (!st) {
+        return FMIError;
+    }
+
+    READ_BYTES(&st->time, sizeof(double));
 
     for (size_t i = 0; i < s->nComponents; i++) {
 
-        FMIInstance* m = s->components[i]->instance;
+        size_t componentSize;
 
-        switch (m->fmiMajorVersion) {
-        case FMIMajorVersion2:
-            CHECK_STATUS(FMI2Reset(m));
-            break;
-        case FMIMajorVersion3:
-            CHECK_STATUS(FMI3Reset(m));
-            break;
-        default:
-            break;
+        READ_BYTES(&st->componentTimes[i], sizeof(double));
+        READ_BYTES(&componentSize, sizeof(size_t));
+
+        if (position + componentSize > size) {
+            status = FMIError;
+            goto END;
         }
+
+        CHECK_STATUS(deserializeComponentState(s->components[i], &serializedState[position], componentSize, &st->componentStates[i]));
+
+        position += componentSize;
+    }
+
+    size_t nTransferBytes;
+
+    READ_BYTES(&nTransferBytes, sizeof(size_t));
+
+    // the state must have been serialized by a container with the same configuration
+    if (nTransferBytes != st->nTransferBytes) {
+        status = FMIError;
+        goto END;
     }
+
+    READ_BYTES(st->transferBytes, nTransferBytes);
+
 END:
+    if (status > FMIWarning) {
+        freeSystemState(s, &st);
+    }
+
+    *state = st;
+
     return status;
 }
 
+#undef READ_BYTES
+
+// Log the timing of the steps and transfers of the components
+static void logStatistics(System* s) {
+
+    const Histogram* h = &s->doStepTime;
+
+    logSystemMessage(s, FMIOK, "logStatistics", "doStep: %llu calls, total %.6f s, mean %.3g s, max %.3g s",
+        (unsigned long long)h->count, h->total, h->count > 0 ? h->total / h->count : 0, h->max);
+
+    for (size_t i = 0; i < s->nComponents; i++) {
+
+        const Component* c = s->components[i];
+        const ComponentStatistics* statistics = c->statistics;
+        const Histogram* wall = &statistics->doStepWallTime;
+
+        logSystemMessage(s, FMIOK, "logStatistics",
+            "%s: %llu steps, wall %.6f s (%.1f %%), CPU %.6f s, median %.3g s, p99 %.3g s, max %.3g s, transfer %.6f s, wait %.6f s",
+            c->instance->name,
+            (unsigned long long)wall->count,
+            wall->total,
+            s->doStepTime.total > 0 ? 100 * wall->total / s->doStepTime.total : 0,
+            statistics->doStepCPUTime.total,
+            histogramQuantile(wall, 0.5),
+            histogramQuantile(wall, 0.99),
+            wall->max,
+            statistics->transferTime.total,
+            statistics->waitTime.total);
+    }
+}
+
+FMIStatus FMUContainerGetComponentStatistics(void* instance, size_t index, const char** name, ComponentStatistics* statistics) {
+
+    System* s = (System*)instance;
+
+    if (!s || index >= s->nComponents || !s->components[index]->statistics) {
+        return FMIError;
+    }
+
+    const Component* c = s->components[index];
+
+    if (name) {
+        *name = c->instance->name;
+    }
+
+    if (statistics) {
+        *statistics = *c->statistics;
+    }
+
+    return FMIOK;
+}
+
 void freeSystem(System* s) {
 
+    if (s->statistics) {
+        logStatistics(s);
+    }
+
+    freeSystemState(s, &s->iterationState);
+    freeSystemState(s, &s->eventState);
+
+    freeThreadPool(s->threadPool);
+
+    for (size_t i = 0; i < s->nWavefronts; i++) {
+        free(s->wavefronts[i].components);
+        free(s->wavefronts[i].connections);
+        freeTransfers(s->wavefronts[i].getTransfers, s->wavefronts[i].nGetTransfers);
+        freeTransfers(s->wavefronts[i].setTransfers, s->wavefronts[i].nSetTransfers);
+    }
+
+    free(s->wavefronts);
+
+    free(s->dispatch.offsets);
+    free(s->dispatch.positions);
+    free(s->dispatch.indices);
+    free(s->dispatch.valueReferences);
+    free(s->dispatch.values);
+
+    free(s->delayed.connections);
+    freeTransfers(s->delayed.getTransfers, s->delayed.nGetTransfers);
+    freeTransfers(s->delayed.setTransfers, s->delayed.nSetTransfers);
+
     for (size_t i = 0; i < s->nComponents; i++) {
 
         Component* component = s->components[i];
+
+        // the components of a failed instantiation may be incomplete
+        if (!component) {
+            continue;
+        }
+
         FMIInstance* m = component->instance;
 
-        switch (m->fmiMajorVersion) {
-        case FMIMajorVersion2:
-            FMI2FreeInstance(m);
-            break;
-        case FMIMajorVersion3:
-            FMI3FreeInstance(m);
-            break;
-        default:
-            break;
+        if (m && m->component) {
+            switch (m->fmiMajorVersion) {
+            case FMIMajorVersion2:
+                FMI2FreeInstance(m);
+                break;
+            case FMIMajorVersion3:
+                FMI3FreeInstance(m);
+                break;
+            default:
+                break;
+            }
         }
-        FMIFreeInstance(m);
-        if (s->parallelDoStep) {
-#ifdef _WIN32
-            CloseHandle(component->mutex);
-            CloseHandle(component->thread);
-#else
-            pthread_mutex_destroy(&component->mutex);
-            pthread_join(component->thread, NULL);
-#endif
+
+        if (m) {
+            FMIFreeInstance(m);
         }
+
+        free(component->statistics);
         free(component);
     }
 
+    free(s->components);
+
+    for (size_t i = 0; i < s->nVariables; i++) {
+        free(s->variables[i].ci);
+        free(s->variables[i].vr);
+    }
+
+    free(s->variables);
+    free(s->connections);
+
+    releaseConfig(s->config);
+
     free((void *) s->instanceName);
     free(s);
 }
@@ -1,10 +1,20 @@
+#include "FMI.h"
+
+#include "ThreadPool.h"
+
+#include "Config.h"
+
+#include "Statistics.h"
+
+
 #ifdef _WIN32
-#include <Windows.h>
+#define FMU_CONTAINER_EXPORT __declspec(dllexport)
 #else
-#include <pthread.h>
+#define FMU_CONTAINER_EXPORT __attribute__((visibility("default")))
 #endif
 
-#include "FMI.h"
+// number of values that are converted at once when the FMI 2.0 type differs from the FMI 3.0 type
+#define CONVERSION_BUFFER_SIZE 64
 
 
 typedef struct {
@@ -15,6 +25,14 @@ typedef struct {
 
 } VariableMapping;
 
+// the values of type Binary in the buffers of the container refer to the data of the components
+typedef struct {
+
+    size_t size;
+    const uint8_t* data;
+
+} BinaryValue;
+
 typedef struct {
 
     FMIVariableType type;
@@ -23,29 +41,152 @@ typedef struct {
     size_t endComponent;
     FMIValueReference endValueReference;
 
+    // number of elements of the connected variables (1 for scalars)
+    size_t size;
+
+    bool delayed;
+    bool feedback;
+
 } Connection;
 
+typedef enum {
+
+    Hold,
+    Linear
+
+} Interpolation;
+
 typedef struct {
 
     FMIInstance* instance;
 
-#ifdef _WIN32
-    HANDLE thread;
-    HANDLE mutex;
-#else
-    pthread_t thread;
-    pthread_mutex_t mutex;
-#endif
+    // the component's own communication step size (0 = the step size passed to doStep())
+    double stepSize;
+
+    // how the Float32 and Float64 outputs are passed on between the component's communication points
+    Interpolation interpolation;
+
+    // the time the component has been advanced to
+    double time;
+
+    // whether the component is stepped in the current call to doStep()
+    bool active;
 
     double currentCommunicationPoint;
     double communicationStepSize;
     bool noSetFMUStatePriorToCurrentPoint;
     FMIStatus status;
-    bool doStep;
-    bool terminate;
+
+    // FMI 3.0 options the component has been instantiated with
+    bool eventModeUsed;
+    bool earlyReturnAllowed;
+
+    // whether the component can get and set its FMU state
+    bool canGetAndSetFMUState;
+
+    // the results of the last step (the component's time is the last successful time)
+    bool earlyReturn;
+    bool eventHandlingNeeded;
+    bool terminateSimulation;
+
+    // whether the component has stopped at the event the system is rolled back to
+    bool stoppedAtEvent;
+
+    // timing of the steps and transfers (NULL if the statistics are not recorded)
+    ComponentStatistics* statistics;
+    double stepEndTime;
 
 } Component;
 
+typedef enum {
+
+    Jacobi,
+    GaussSeidel
+
+} MasterAlgorithm;
+
+typedef struct {
+
+    Component* component;
+    FMIVariableType type;
+
+    // whether the values are transferred over feedback connections
+    bool feedback;
+
+    size_t nValueReferences;
+    FMIValueReference* valueReferences;
+
+    // number of elements of every variable and of all variables (arrays are stored flattened)
+    size_t* sizes;
+    size_t nValues;
+
+    void* values;
+
+    // the locations of the values of the variables in the get transfers (only used by set transfers)
+    const void** sources;
+
+    // copies of the retrieved strings (only used by get transfers of type String)
+    char** strings;
+
+    // the outputs at the source component's last two communication points (only used by
+    // get transfers that interpolate the outputs of a component with a larger step size)
+    bool interpolate;
+    bool sampled;
+    double sampleTimes[2];
+    void* samples[2];
+
+    // the values at the end of the step (only used by get transfers of iterated connections)
+    void* iterates;
+
+} Transfer;
+
+typedef struct {
+
+    size_t nComponents;
+    Component** components;
+
+    size_t nConnections;
+    Connection** connections;
+
+    // connections grouped by (startComponent, type) and (endComponent, type)
+    size_t nGetTransfers;
+    Transfer* getTransfers;
+
+    size_t nSetTransfers;
+    Transfer* setTransfers;
+
+} Wavefront;
+
+// buffers to sort the values of the container variables by component
+typedef struct {
+
+    // start index of the values of every component (nComponents + 1)
+    size_t* offsets;
+    size_t* positions;
+
+    size_t capacity;
+    size_t* indices;
+    FMIValueReference* valueReferences;
+
+    size_t valuesSize;
+    void* values;
+
+} Dispatch;
+
+typedef struct {
+
+    double time;
+
+    // times and FMU states of the components
+    double* componentTimes;
+    void** componentStates;
+
+    // copy of the values in the get transfers
+    size_t nTransferBytes;
+    char* transferBytes;
+
+} SystemState;
+
 typedef struct {
 
     FMIMajorVersion fmiMajorVersion;
@@ -56,32 +197,90 @@ typedef struct {
     
     void* logMessage;
 
+    // the configuration the system was instantiated from
+    Config* config;
+
     size_t nComponents;
     Component** components;
 
     size_t nVariables;
     VariableMapping* variables;
 
+    Dispatch dispatch;
+
     size_t nConnections;
     Connection* connections;
 
+    MasterAlgorithm masterAlgorithm;
+
+    size_t nWavefronts;
+    Wavefront* wavefronts;
+
+    // delayed connections that are transferred before the first wavefront (Gauss-Seidel only)
+    Wavefront delayed;
+
+    // fixed-point iteration over the connections that use the values of the previous step
+    size_t maxIterations;
+    double iterationTolerance;
+    size_t iteration;
+    SystemState* iterationState;
+
+    // roll back the components to the earliest event when a component returns early
+    bool rollBackToEvents;
+    SystemState* eventState;
+
+    // whether doStep() may return at an event before the end of the step (FMI 3.0)
+    bool earlyReturnAllowed;
+
+    // the results of the last call to doStep()
+    bool earlyReturn;
+    bool terminateSimulation;
+    double lastSuccessfulTime;
+
     bool parallelDoStep;
 
+    // whether the timing statistics are recorded
+    bool statistics;
+    Histogram doStepTime;
+
+    size_t nThreads;
+    ThreadPool* threadPool;
+
     double time;
 
 } System;
 
+size_t sizeOfVariableType(FMIVariableType variableType);
+
 FMIStatus getVariable(
     FMIInstance *instance,
     FMIVariableType variableType,
-    const FMIValueReference* valueReference,
-    void* value);
+    const FMIValueReference valueReferences[],
+    size_t nValueReferences,
+    void* values,
+    size_t nValues);
 
 FMIStatus setVariable(
     FMIInstance *instance,
     FMIVariableType variableType,
-    const FMIValueReference* valueReference,
-    void* value);
+    const FMIValueReference valueReferences[],
+    size_t nValueReferences,
+    const void* values,
+    size_t nValues);
+
+FMIStatus getVariables(
+    System* s,
+    FMIVariableType variableType,
+    const FMIValueReference valueReferences[],
+    size_t nValueReferences,
+    void* values);
+
+FMIStatus setVariables(
+    System* s,
+    FMIVariableType variableType,
+    const FMIValueReference valueReferences[],
+    size_t nValueReferences,
+    const void* values);
 
 System* instantiateSystem(
     FMIMajorVersion fmiMajorVersion,
@@ -92,6 +291,8 @@ System* instantiateSystem(
     bool loggingOn, 
     bool visible);
 
+void setStartTime(System* s, double startTime);
+
 FMIStatus doStep(
     System* s,
     double  currentCommunicationPoint,
@@ -103,4 +304,20 @@ FMIStatus terminateSystem(System* s);
 
 FMIStatus resetSystem(System* s);
 
+FMIStatus getSystemState(System* s, SystemState** state);
+
+FMIStatus setSystemState(System* s, const SystemState* state);
+
+FMIStatus freeSystemState(System* s, SystemState** state);
+
+FMIStatus serializedSystemStateSize(System* s, const SystemState* state, size_t* size);
+
+FMIStatus serializeSystemState(System* s, const SystemState* state, char serializedState[], size_t size);
+
+FMIStatus deserializeSystemState(System* s, const char serializedState[], size_t size, SystemState** state);
+
 void freeSystem(System* s);
+
+/* Copy the timing statistics of the component with the given index. Returns FMIError if the
+   index is out of range or the container has not been configured to record the statistics. */
+FMU_CONTAINER_EXPORT FMIStatus FMUContainerGetComponentStatistics(void* instance, size_t index, const char** name, ComponentStatistics* statistics);
@@ -0,0 +1,94 @@
+/* This file is part of FMPy. See LICENSE.txt for license information. */
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <time.h>
+#endif
+
+#include "Statistics.h"
+
+
+void addSample(Histogram* histogram, double duration) {
+
+    if (histogram->count == 0 || duration < histogram->min) {
+        histogram->min = duration;
+    }
+
+    if (histogram->count == 0 || duration > histogram->max) {
+        histogram->max = duration;
+    }
+
+    histogram->count++;
+    histogram->total += duration;
+
+    size_t bin = 0;
+
+    for (double limit = 1e-6; bin < HISTOGRAM_BINS - 1 && duration >= limit; limit *= 2) {
+        bin++;
+    }
+
+    histogram->bins[bin]++;
+}
+
+double histogramQuantile(const Histogram* histogram, double fraction) {
+
+    if (histogram->count == 0) {
+        return 0;
+    }
+
+    const double target = fraction * histogram->count;
+
+    uint64_t count = 0;
+    double limit = 1e-6;
+
+    for (size_t bin = 0; bin < HISTOGRAM_BINS - 1; bin++, limit *= 2) {
+
+        count += histogram->bins[bin];
+
+        if (count >= target) {
+            return limit < histogram->max ? limit : histogram->max;
+        }
+    }
+
+    return histogram->max;
+}
+
+double wallTime(void) {
+#ifdef _WIN32
+    static LARGE_INTEGER frequency = { 0 };
+    LARGE_INTEGER counter;
+
+    if (frequency.QuadPart == 0) {
+        QueryPerformanceFrequency(&frequency);
+    }
+
+    QueryPerformanceCounter(&counter);
+
+    return (double)counter.QuadPart / (double)frequency.QuadPart;
+#else
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (double)t.tv_sec + 1e-9 * (double)t.tv_nsec;
+#endif
+}
+
+double threadCPUTime(void) {
+#ifdef _WIN32
+    FILETIME creationTime, exitTime, kernelTime, userTime;
+
+    if (!GetThreadTimes(GetCurrentThread(), &creationTime, &exitTime, &kernelTime, &userTime)) {
+        return 0;
+    }
+
+    // the times are given in units of 100 ns
+    const ULONGLONG kernel = ((ULONGLONG)kernelTime.dwHighDateTime << 32) | kernelTime.dwLowDateTime;
+    const ULONGLONG user = ((ULONGLONG)userTime.dwHighDateTime << 32) | userTime.dwLowDateTime;
+
+    return 1e-7 * (double)(kernel + user);
+#else
+    struct timespec t;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &t);
+    return (double)t.tv_sec + 1e-9 * (double)t.tv_nsec;
+#endif
+}
@@ -0,0 +1,47 @@
+#ifndef STATISTICS_H
+#define STATISTICS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+#define HISTOGRAM_BINS 32
+
+/* Running statistics of durations in seconds. Bin 0 counts the durations below 1 us,
+   bin i the durations in [2^(i-1), 2^i) us and the last bin all longer durations. */
+typedef struct {
+
+    uint64_t count;
+    double total;
+    double min;
+    double max;
+    uint64_t bins[HISTOGRAM_BINS];
+
+} Histogram;
+
+typedef struct {
+
+    // duration of the calls to doStep() of the component
+    Histogram doStepWallTime;
+    Histogram doStepCPUTime;
+
+    // duration of the transfers from and to the component
+    Histogram transferTime;
+
+    // time from the end of the component's step to the end of the parallel step
+    Histogram waitTime;
+
+} ComponentStatistics;
+
+void addSample(Histogram* histogram, double duration);
+
+/* Upper bound of the bin that contains the given fraction (0..1) of the samples */
+double histogramQuantile(const Histogram* histogram, double fraction);
+
+/* Monotonic wall clock time in seconds */
+double wallTime(void);
+
+/* CPU time of the calling thread in seconds */
+double threadCPUTime(void);
+
+#endif
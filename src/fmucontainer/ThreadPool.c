@@ -0,0 +1,379 @@
+/* This file is part of FMPy. See LICENSE.txt for license information. */
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "ThreadPool.h"
+
+
+#ifdef _WIN32
+#define MUTEX                       CRITICAL_SECTION
+#define CONDITION                   CONDITION_VARIABLE
+#define INIT_MUTEX(M)               InitializeCriticalSection(&(M))
+#define DESTROY_MUTEX(M)            DeleteCriticalSection(&(M))
+#define INIT_CONDITION(C)           InitializeConditionVariable(&(C))
+#define DESTROY_CONDITION(C)
+#define LOCK(M)                     EnterCriticalSection(&(M))
+#define UNLOCK(M)                   LeaveCriticalSection(&(M))
+#define WAIT(C, M)                  SleepConditionVariableCS(&(C), &(M), INFINITE)
+#define SIGNAL(C)                   WakeConditionVariable(&(C))
+#define BROADCAST(C)                WakeAllConditionVariable(&(C))
+#else
+#define MUTEX                       pthread_mutex_t
+#define CONDITION                   pthread_cond_t
+#define INIT_MUTEX(M)               pthread_mutex_init(&(M), NULL)
+#define DESTROY_MUTEX(M)            pthread_mutex_destroy(&(M))
+#define INIT_CONDITION(C)           pthread_cond_init(&(C), NULL)
+#define DESTROY_CONDITION(C)        pthread_cond_destroy(&(C))
+#define LOCK(M)                     pthread_mutex_lock(&(M))
+#define UNLOCK(M)                   pthread_mutex_unlock(&(M))
+#define WAIT(C, M)                  pthread_cond_wait(&(C), &(M))
+#define SIGNAL(C)                   pthread_cond_signal(&(C))
+#define BROADCAST(C)                pthread_cond_broadcast(&(C))
+#endif
+
+
+typedef struct {
+
+    MUTEX mutex;
+
+    size_t* tasks;
+    size_t head;
+    size_t tail;
+
+} TaskQueue;
+
+typedef struct {
+
+    ThreadPool* pool;
+    size_t index;
+
+#ifdef _WIN32
+    HANDLE thread;
+#else
+    pthread_t thread;
+#endif
+
+} Worker;
+
+struct ThreadPool {
+
+    size_t nWorkers;
+    Worker* workers;
+
+    size_t capacity;
+    TaskQueue* queues;
+
+    MUTEX mutex;
+    CONDITION workAvailable;
+    CONDITION workFinished;
+
+    size_t generation;
+    size_t nActiveWorkers;
+    bool terminate;
+
+    ThreadPoolTask* task;
+    void* context;
+};
+
+
+// take the most recently queued task of the worker's own queue
+static bool popTask(TaskQueue* queue, size_t* index) {
+
+    bool success = false;
+
+    LOCK(queue->mutex);
+
+    if (queue->head < queue->tail) {
+        *index = queue->tasks[--queue->tail];
+        success = true;
+    }
+
+    UNLOCK(queue->mutex);
+
+    return success;
+}
+
+// take the oldest task from another worker's queue
+static bool stealTask(TaskQueue* queue, size_t* index) {
+
+    bool success = false;
+
+    LOCK(queue->mutex);
+
+    if (queue->head < queue->tail) {
+        *index = queue->tasks[queue->head++];
+        success = true;
+    }
+
+    UNLOCK(queue->mutex);
+
+    return success;
+}
+
+static void processTasks(ThreadPool* pool, size_t worker) {
+
+    size_t index;
+
+    while (true) {
+
+        bool found = popTask(&pool->queues[worker], &index);
+
+        for (size_t i = 1; !found && i < pool->nWorkers; i++) {
+            found = stealTask(&pool->queues[(worker + i) % pool->nWorkers], &index);
+        }
+
+        if (!found) {
+            return;
+        }
+
+        pool->task(pool->context, index);
+    }
+}
+
+#ifdef _WIN32
+static DWORD WINAPI workerThread(LPVOID lpParam) {
+
+    Worker* w = (Worker*)lpParam;
+#else
+static void* workerThread(void* arg) {
+
+    Worker* w = (Worker*)arg;
+#endif
+
+    ThreadPool* pool = w->pool;
+
+    size_t generation = 0;
+
+    LOCK(pool->mutex);
+
+    while (true) {
+
+        while (pool->generation == generation && !pool->terminate) {
+            WAIT(pool->workAvailable, pool->mutex);
+        }
+
+        if (pool->terminate) {
+            break;
+        }
+
+        generation = pool->generation;
+
+        UNLOCK(pool->mutex);
+
+        processTasks(pool, w->index);
+
+        LOCK(pool->mutex);
+
+        if (--pool->nActiveWorkers == 0) {
+            SIGNAL(pool->workFinished);
+        }
+    }
+
+    UNLOCK(pool->mutex);
+
+#ifdef _WIN32
+    return TRUE;
+#else
+    return NULL;
+#endif
+}
+
+ThreadPool* createThreadPool(size_t nThreads) {
+
+    ThreadPool* pool = calloc(1, sizeof(ThreadPool));
+
+    if (!pool) {
+        return NULL;
+    }
+
+    pool->nWorkers = nThreads > 0 ? nThreads : 1;
+    pool->workers = calloc(pool->nWorkers, sizeof(Worker));
+    pool->queues = calloc(pool->nWorkers, sizeof(TaskQueue));
+
+    if (!pool->workers || !pool->queues) {
+        free(pool->workers);
+        free(pool->queues);
+        free(pool);
+        return NULL;
+    }
+
+    INIT_MUTEX(pool->mutex);
+    INIT_CONDITION(pool->workAvailable);
+    INIT_CONDITION(pool->workFinished);
+
+    for (size_t i = 0; i < pool->nWorkers; i++) {
+        INIT_MUTEX(pool->queues[i].mutex);
+    }
+
+    // worker 0 is the thread that calls runThreadPool()
+    for (size_t i = 1; i < pool->nWorkers; i++) {
+
+        Worker* w = &pool->workers[i];
+
+        w->pool = pool;
+        w->index = i;
+
+        bool started;
+
+#ifdef _WIN32
+        w->thread = CreateThread(NULL, 0, workerThread, w, 0, NULL);
+        started = w->thread != NULL;
+#else
+        started = pthread_create(&w->thread, NULL, &workerThread, w) == 0;
+#endif
+
+        if (!started) {
+            // continue with the workers that have been started
+            for (size_t j = i; j < pool->nWorkers; j++) {
+                DESTROY_MUTEX(pool->queues[j].mutex);
+            }
+            pool->nWorkers = i;
+            break;
+        }
+    }
+
+    return pool;
+}
+
+// Grow the queues to capacity tasks or keep the current ones if the memory can't be allocated
+static bool growQueues(ThreadPool* pool, size_t capacity) {
+
+    size_t** tasks = calloc(pool->nWorkers, sizeof(size_t*));
+
+    if (!tasks) {
+        return false;
+    }
+
+    for (size_t i = 0; i < pool->nWorkers; i++) {
+
+        tasks[i] = calloc(capacity, sizeof(size_t));
+
+        if (!tasks[i]) {
+            for (size_t j = 0; j < i; j++) {
+                free(tasks[j]);
+            }
+            free(tasks);
+            return false;
+        }
+    }
+
+    for (size_t i = 0; i < pool->nWorkers; i++) {
+        free(pool->queues[i].tasks);
+        pool->queues[i].tasks = tasks[i];
+    }
+
+    free(tasks);
+
+    pool->capacity = capacity;
+
+    return true;
+}
+
+void runThreadPool(ThreadPool* pool, ThreadPoolTask* task, void* context, size_t nTasks) {
+
+    if (nTasks == 0) {
+        return;
+    }
+
+    // the workers are idle, so the queues can be refilled without locking
+    const size_t capacity = (nTasks + pool->nWorkers - 1) / pool->nWorkers;
+
+    if (pool->nWorkers > 1 && capacity > pool->capacity && !growQueues(pool, capacity)) {
+        // run the tasks on the calling thread if the queues can't be grown
+        for (size_t i = 0; i < nTasks; i++) {
+            task(context, i);
+        }
+        return;
+    }
+
+    if (pool->nWorkers == 1) {
+        for (size_t i = 0; i < nTasks; i++) {
+            task(context, i);
+        }
+        return;
+    }
+
+    for (size_t i = 0; i < pool->nWorkers; i++) {
+        pool->queues[i].head = 0;
+        pool->queues[i].tail = 0;
+    }
+
+    for (size_t i = 0; i < nTasks; i++) {
+        TaskQueue* queue = &pool->queues[i % pool->nWorkers];
+        queue->tasks[queue->tail++] = i;
+    }
+
+    LOCK(pool->mutex);
+
+    pool->task = task;
+    pool->context = context;
+    pool->nActiveWorkers = pool->nWorkers - 1;
+    pool->generation++;
+
+    BROADCAST(pool->workAvailable);
+
+    UNLOCK(pool->mutex);
+
+    processTasks(pool, 0);
+
+    LOCK(pool->mutex);
+
+    while (pool->nActiveWorkers > 0) {
+        WAIT(pool->workFinished, pool->mutex);
+    }
+
+    UNLOCK(pool->mutex);
+}
+
+void freeThreadPool(ThreadPool* pool) {
+
+    if (!pool) {
+        return;
+    }
+
+    LOCK(pool->mutex);
+    pool->terminate = true;
+    BROADCAST(pool->workAvailable);
+    UNLOCK(pool->mutex);
+
+    for (size_t i = 1; i < pool->nWorkers; i++) {
+#ifdef _WIN32
+        WaitForSingleObject(pool->workers[i].thread, INFINITE);
+        CloseHandle(pool->workers[i].thread);
+#else
+        pthread_join(pool->workers[i].thread, NULL);
+#endif
+    }
+
+    for (size_t i = 0; i < pool->nWorkers; i++) {
+        DESTROY_MUTEX(pool->queues[i].mutex);
+        free(pool->queues[i].tasks);
+    }
+
+    DESTROY_MUTEX(pool->mutex);
+    DESTROY_CONDITION(pool->workAvailable);
+    DESTROY_CONDITION(pool->workFinished);
+
+    free(pool->queues);
+    free(pool->workers);
+    free(pool);
+}
+
+size_t numberOfProcessors(void) {
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors;
+#else
+    const long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (size_t)n : 1;
+#endif
+}
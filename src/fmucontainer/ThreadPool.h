@@ -0,0 +1,26 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <stddef.h>
+
+
+/* A task of a parallel run. The index identifies the task within the run. */
+typedef void ThreadPoolTask(void* context, size_t index);
+
+typedef struct ThreadPool ThreadPool;
+
+/* Create a pool with nThreads workers. The thread that calls runThreadPool()
+   acts as one of the workers, so nThreads - 1 threads are started. */
+ThreadPool* createThreadPool(size_t nThreads);
+
+/* Run the tasks 0..nTasks-1 and return when all of them have finished. The tasks
+   are distributed round-robin to the workers and idle workers steal tasks from
+   the queues of busy workers. If the memory for the queues can't be allocated, the
+   tasks run on the calling thread. */
+void runThreadPool(ThreadPool* pool, ThreadPoolTask* task, void* context, size_t nTasks);
+
+void freeThreadPool(ThreadPool* pool);
+
+size_t numberOfProcessors(void);
+
+#endif
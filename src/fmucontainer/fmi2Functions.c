@@ -80,7 +80,7 @@ fmi2Status fmi2SetupExperiment(fmi2Component c,
 
     GET_SYSTEM;
 
-    s->time = startTime;
+    setStartTime(s, startTime);
 
     for (size_t i = 0; i < s->nComponents; i++) {
         FMIInstance* m = s->components[i]->instance;
@@ -139,59 +139,30 @@ fmi2Status fmi2GetReal(fmi2Component c, const fmi2ValueReference vr[], size_t nv
 
     GET_SYSTEM;
 
-    for (size_t i = 0; i < nvr; i++) {
-
-        if (vr[i] == 0) {
-            value[i] = s->time;
-            continue;
-        }
-
-        if (vr[i] > s->nVariables) {
-            return fmi2Error;
-        }
-
-        const VariableMapping* vm = &s->variables[vr[i] - 1];
-        FMIInstance* m = s->components[vm->ci[0]]->instance;
-
-        CHECK_STATUS(FMI2GetReal(m, &(vm->vr[0]), 1, &value[i]));
-    }
-END:
-    return status;
+    return getVariables(s, FMIFloat64Type, vr, nvr, value);
 }
 
 fmi2Status fmi2GetInteger(fmi2Component c, const fmi2ValueReference vr[], size_t nvr, fmi2Integer value[]) {
 
     GET_SYSTEM;
 
-    for (size_t i = 0; i < nvr; i++) {
-
-        if (vr[i] == 0 || vr[i] > s->nVariables) {
-            return fmi2Error;
-        }
-        
-        const VariableMapping* vm = &s->variables[vr[i] - 1];
-        FMIInstance* m = s->components[vm->ci[0]]->instance;
-        
-        CHECK_STATUS(FMI2GetInteger(m, &(vm->vr[0]), 1, &value[i]));
-    }
-END:
-    return status;
+    return getVariables(s, FMIInt32Type, vr, nvr, value);
 }
 
 fmi2Status fmi2GetBoolean(fmi2Component c, const fmi2ValueReference vr[], size_t nvr, fmi2Boolean value[]) {
 
     GET_SYSTEM;
 
-    for (size_t i = 0; i < nvr; i++) {
+    for (size_t i = 0; i < nvr; i += CONVERSION_BUFFER_SIZE) {
 
-        if (vr[i] == 0 || vr[i] > s->nVariables) {
-            return fmi2Error;
-        }
+        const size_t n = nvr - i < CONVERSION_BUFFER_SIZE ? nvr - i : CONVERSION_BUFFER_SIZE;
+        bool v[CONVERSION_BUFFER_SIZE];
 
-        const VariableMapping* vm = &s->variables[vr[i] - 1];
-        FMIInstance* m = s->components[vm->ci[0]]->instance;
+        CHECK_STATUS(getVariables(s, FMIBooleanType, &vr[i], n, v));
 
-        CHECK_STATUS(FMI2GetBoolean(m, &(vm->vr[0]), 1, &value[i]));
+        for (size_t j = 0; j < n; j++) {
+            value[i + j] = v[j] ? fmi2True : fmi2False;
+        }
     }
 END:
     return status;
@@ -201,79 +172,37 @@ fmi2Status fmi2GetString(fmi2Component c, const fmi2ValueReference vr[], size_t
 
     GET_SYSTEM;
 
-    for (size_t i = 0; i < nvr; i++) {
-
-        if (vr[i] == 0 || vr[i] > s->nVariables) {
-            return fmi2Error;
-        }
-
-        const VariableMapping* vm = &s->variables[vr[i] - 1];
-        FMIInstance* m = s->components[vm->ci[0]]->instance;
-
-        CHECK_STATUS(FMI2GetString(m, &(vm->vr[0]), 1, &value[i]));
-    }
-END:
-    return status;
+    return getVariables(s, FMIStringType, vr, nvr, value);
 }
 
 fmi2Status fmi2SetReal(fmi2Component c, const fmi2ValueReference vr[], size_t nvr, const fmi2Real value[]) {
 
     GET_SYSTEM;
 
-    for (size_t i = 0; i < nvr; i++) {
-
-        if (vr[i] == 0 || vr[i] > s->nVariables) {
-            return fmi2Error;
-        }
-
-        const VariableMapping* vm = &s->variables[vr[i] - 1];
-        
-        for (size_t j = 0; j < vm->size; j++) {
-            FMIInstance* m = s->components[vm->ci[j]]->instance;
-            CHECK_STATUS(FMI2SetReal(m, &(vm->vr[j]), 1, &value[i]));
-        }
-    }
-END:
-    return status;
+    return setVariables(s, FMIFloat64Type, vr, nvr, value);
 }
 
 fmi2Status fmi2SetInteger(fmi2Component c, const fmi2ValueReference vr[], size_t nvr, const fmi2Integer value[]) {
 
     GET_SYSTEM;
 
-    for (size_t i = 0; i < nvr; i++) {
-        
-        if (vr[i] == 0 || vr[i] > s->nVariables) {
-            return fmi2Error;
-        }
-
-        const VariableMapping* vm = &s->variables[vr[i] - 1];
-        
-        for (size_t j = 0; j < vm->size; j++) {
-            FMIInstance* m = s->components[vm->ci[j]]->instance;
-            CHECK_STATUS(FMI2SetInteger(m, &(vm->vr[j]), 1, &value[i]));
-        }
-    }
-END:
-    return status;
+    return setVariables(s, FMIInt32Type, vr, nvr, value);
 }
 
 fmi2Status fmi2SetBoolean(fmi2Component c, const fmi2ValueReference vr[], size_t nvr, const fmi2Boolean value[]) {
 
     GET_SYSTEM;
 
-    for (size_t i = 0; i < nvr; i++) {
+    for (size_t i = 0; i < nvr; i += CONVERSION_BUFFER_SIZE) {
 
-        if (vr[i] == 0 || vr[i] > s->nVariables) {
-            return fmi2Error;
-        }
+        const size_t n = nvr - i < CONVERSION_BUFFER_SIZE ? nvr - i : CONVERSION_BUFFER_SIZE;
+        bool v[CONVERSION_BUFFER_SIZE];
 
-        const VariableMapping* vm = &s->variables[vr[i] - 1];
-        
-        for (size_t j = 0; j < vm->size; j++) {
-            FMIInstance* m = s->components[vm->ci[j]]->instance;
-            CHECK_STATUS(FMI2SetBoolean(m, &(vm->vr[j]), 1, &value[i]));
+        for (size_t j = 0; j < n; j++) {
+            v[j] = value[i + j] != fmi2False;
         }
+
+        CHECK_STATUS(setVariables(s, FMIBooleanType, &vr[i], n, v));
     }
 END:
     return status;
@@ -283,45 +212,50 @@ fmi2Status fmi2SetString(fmi2Component c, const fmi2ValueReference vr[], size_t
 
     GET_SYSTEM;
 
-    for (size_t i = 0; i < nvr; i++) {
-
-        if (vr[i] == 0 || vr[i] > s->nVariables) {
-            return fmi2Error;
-        }
-        
-        const VariableMapping* vm = &s->variables[vr[i] - 1];
-        for (size_t j = 0; j < vm->size; j++) {
-            FMIInstance* m = s->components[vm->ci[j]]->instance;
-            CHECK_STATUS(FMI2SetString(m, &(vm->vr[j]), 1, &value[i]));
-        }
-    }
-END:
-    return status;
+    return setVariables(s, FMIStringType, vr, nvr, value);
 }
 
 /* Getting and setting the internal FMU state */
 fmi2Status fmi2GetFMUstate(fmi2Component c, fmi2FMUstate* FMUstate) {
-    NOT_IMPLEMENTED;
+
+    GET_SYSTEM;
+
+    return getSystemState(s, (SystemState**)FMUstate);
 }
 
 fmi2Status fmi2SetFMUstate(fmi2Component c, fmi2FMUstate  FMUstate) {
-    NOT_IMPLEMENTED;
+
+    GET_SYSTEM;
+
+    return setSystemState(s, (SystemState*)FMUstate);
 }
 
 fmi2Status fmi2FreeFMUstate(fmi2Component c, fmi2FMUstate* FMUstate) {
-    NOT_IMPLEMENTED;
+
+    GET_SYSTEM;
+
+    return freeSystemState(s, (SystemState**)FMUstate);
 }
 
 fmi2Status fmi2SerializedFMUstateSize(fmi2Component c, fmi2FMUstate  FMUstate, size_t* size) {
-    NOT_IMPLEMENTED;
+
+    GET_SYSTEM;
+
+    return serializedSystemStateSize(s, (SystemState*)FMUstate, size);
 }
 
 fmi2Status fmi2SerializeFMUstate(fmi2Component c, fmi2FMUstate  FMUstate, fmi2Byte serializedState[], size_t size) {
-    NOT_IMPLEMENTED;
+
+    GET_SYSTEM;
+
+    return serializeSystemState(s, (SystemState*)FMUstate, serializedState, size);
 }
 
 fmi2Status fmi2DeSerializeFMUstate(fmi2Component c, const fmi2Byte serializedState[], size_t size, fmi2FMUstate* FMUstate) {
-    NOT_IMPLEMENTED;
+
+    GET_SYSTEM;
+
+    return deserializeSystemState(s, serializedState, size, (SystemState**)FMUstate);
 }
 
 /* Getting partial derivatives */
@@ -19,32 +19,13 @@
 
 #define GET_VARIABLES(T) \
 GET_SYSTEM; \
-for (size_t i = 0; i < nValueReferences; i++) { \
-    const fmi3ValueReference vr = valueReferences[i]; \
-    const size_t j = vr - 1; \
-    if (j >= s->nVariables) { \
-        return FMIError; \
-    } \
-    VariableMapping vm = s->variables[j]; \
-    FMIInstance* m = s->components[vm.ci[0]]->instance; \
-    CHECK_STATUS(getVariable(m, FMI ## T ## Type, &(vm.vr[0]), &values[i])); \
-} \
-END: \
-return status; \
+UNUSED(nValues); \
+return getVariables(s, FMI ## T ## Type, valueReferences, nValueReferences, values)
 
 #define SET_VARIABLES(T) \
 GET_SYSTEM; \
-for (size_t i = 0; i < nValueReferences; i++) { \
-    const size_t j = valueReferences[i] - 1; \
-    if (j >= s->nVariables) { \
-        return FMIError; \
-    } \
-    VariableMapping vm = s->variables[j]; \
-    FMIInstance* m = s->components[vm.ci[0]]->instance; \
-    CHECK_STATUS(setVariable(m, FMI ## T ## Type, &(vm.vr[0]), &values[i])); \
-} \
-END: \
-return status; \
+UNUSED(nValues); \
+return setVariables(s, FMI ## T ## Type, valueReferences, nValueReferences, values)
 
 const char* fmi3GetVersion(void) {
     return fmi3Version;
@@ -82,7 +63,13 @@ fmi3Instance fmi3InstantiateCoSimulation(
     fmi3LogMessageCallback         logMessage,
     fmi3IntermediateUpdateCallback intermediateUpdate) {
 
-    return instantiateSystem(FMIMajorVersion3, resourcePath, instanceName, logMessage, instanceEnvironment, loggingOn, visible);
+    System* s = instantiateSystem(FMIMajorVersion3, resourcePath, instanceName, logMessage, instanceEnvironment, loggingOn, visible);
+
+    if (s) {
+        s->earlyReturnAllowed = earlyReturnAllowed;
+    }
+
+    return s;
 }
 
 fmi3Instance fmi3InstantiateScheduledExecution(
@@ -115,7 +102,7 @@ fmi3Status fmi3EnterInitializationMode(fmi3Instance instance,
 
     GET_SYSTEM;
 
-    s->time = startTime;
+    setStartTime(s, startTime);
 
     for (size_t i = 0; i < s->nComponents; i++) {
         FMIInstance* m = s->components[i]->instance;
@@ -163,15 +150,8 @@ fmi3Status fmi3EnterEventMode(fmi3Instance instance) {
     GET_SYSTEM;
 
     for (size_t i = 0; i < s->nComponents; i++) {
-        FMIInstance* m = s->components[i]->instance;
-        switch (m->fmiMajorVersion) {
-        case FMIMajorVersion2:
-            break;
-        case FMIMajorVersion3:
-            CHECK_STATUS(FMI3EnterEventMode(m));
-            break;
-        default:
-            break;
+        if (s->components[i]->eventModeUsed) {
+            CHECK_STATUS(FMI3EnterEventMode(s->components[i]->instance));
         }
     }
 
@@ -208,30 +188,7 @@ fmi3Status fmi3GetFloat64(fmi3Instance instance,
     fmi3Float64 values[],
     size_t nValues) {
 
-    GET_SYSTEM;
-
-    for (size_t i = 0; i < nValueReferences; i++) {
-
-        const fmi3ValueReference vr = valueReferences[i];
-
-        if (vr == 0) {
-            values[i] = s->time;
-            continue;
-        }
-
-        const size_t j = vr - 1;
-
-        if (j >= s->nVariables) {
-            return FMIError;
-        }
-
-        VariableMapping vm = s->variables[j];
-        FMIInstance* m = s->components[vm.ci[0]]->instance;
-        CHECK_STATUS(getVariable(m, FMIFloat64Type, &(vm.vr[0]), &values[i]));
-    }
-
-END:
-    return status;
+    GET_VARIABLES(Float64);
 }
 
 fmi3Status fmi3GetInt8(fmi3Instance instance,
@@ -330,14 +287,37 @@ fmi3Status fmi3GetBinary(fmi3Instance instance,
     size_t valueSizes[],
     fmi3Binary values[],
     size_t nValues) {
-    NOT_IMPLEMENTED;
+
+    GET_SYSTEM;
+
+    UNUSED(nValues);
+
+    for (size_t i = 0; i < nValueReferences; i += CONVERSION_BUFFER_SIZE) {
+
+        const size_t n = nValueReferences - i < CONVERSION_BUFFER_SIZE ? nValueReferences - i : CONVERSION_BUFFER_SIZE;
+        BinaryValue v[CONVERSION_BUFFER_SIZE];
+
+        CHECK_STATUS(getVariables(s, FMIBinaryType, &valueReferences[i], n, v));
+
+        // the data is owned by the components and is passed on without copying
+        for (size_t j = 0; j < n; j++) {
+            valueSizes[i + j] = v[j].size;
+            values[i + j] = v[j].data;
+        }
+    }
+
+END:
+    return status;
 }
 
 fmi3Status fmi3GetClock(fmi3Instance instance,
     const fmi3ValueReference valueReferences[],
     size_t nValueReferences,
     fmi3Clock values[]) {
-    NOT_IMPLEMENTED;
+
+    GET_SYSTEM;
+
+    return getVariables(s, FMIClockType, valueReferences, nValueReferences, values);
 }
 
 fmi3Status fmi3SetFloat32(fmi3Instance instance,
@@ -454,14 +434,36 @@ fmi3Status fmi3SetBinary(fmi3Instance instance,
     const size_t valueSizes[],
     const fmi3Binary values[],
     size_t nValues) {
-    NOT_IMPLEMENTED;
+
+    GET_SYSTEM;
+
+    UNUSED(nValues);
+
+    for (size_t i = 0; i < nValueReferences; i += CONVERSION_BUFFER_SIZE) {
+
+        const size_t n = nValueReferences - i < CONVERSION_BUFFER_SIZE ? nValueReferences - i : CONVERSION_BUFFER_SIZE;
+        BinaryValue v[CONVERSION_BUFFER_SIZE];
+
+        for (size_t j = 0; j < n; j++) {
+            v[j].size = valueSizes[i + j];
+            v[j].data = values[i + j];
+        }
+
+        CHECK_STATUS(setVariables(s, FMIBinaryType, &valueReferences[i], n, v));
+    }
+
+END:
+    return status;
 }
 
 fmi3Status fmi3SetClock(fmi3Instance instance,
     const fmi3ValueReference valueReferences[],
     size_t nValueReferences,
     const fmi3Clock values[]) {
-    NOT_IMPLEMENTED;
+
+    GET_SYSTEM;
+
+    return setVariables(s, FMIClockType, valueReferences, nValueReferences, values);
 }
 
 fmi3Status fmi3GetNumberOfVariableDependencies(fmi3Instance instance,
@@ -480,30 +482,54 @@ fmi3Status fmi3GetVariableDependencies(fmi3Instance instance,
     NOT_IMPLEMENTED;
 }
 
-fmi3Status fmi3GetFMUState(fmi3Instance instance, fmi3FMUState* FMUState) { NOT_IMPLEMENTED; }
+fmi3Status fmi3GetFMUState(fmi3Instance instance, fmi3FMUState* FMUState) {
+
+    GET_SYSTEM;
+
+    return getSystemState(s, (SystemState**)FMUState);
+}
+
+fmi3Status fmi3SetFMUState(fmi3Instance instance, fmi3FMUState  FMUState) {
 
-fmi3Status fmi3SetFMUState(fmi3Instance instance, fmi3FMUState  FMUState) { NOT_IMPLEMENTED; }
+    GET_SYSTEM;
 
-fmi3Status fmi3FreeFMUState(fmi3Instance instance, fmi3FMUState* FMUState) { NOT_IMPLEMENTED; }
+    return setSystemState(s, (SystemState*)FMUState);
+}
+
+fmi3Status fmi3FreeFMUState(fmi3Instance instance, fmi3FMUState* FMUState) {
+
+    GET_SYSTEM;
+
+    return freeSystemState(s, (SystemState**)FMUState);
+}
 
 fmi3Status fmi3SerializedFMUStateSize(fmi3Instance instance,
     fmi3FMUState FMUState,
     size_t* size) {
-    NOT_IMPLEMENTED;
+
+    GET_SYSTEM;
+
+    return serializedSystemStateSize(s, (SystemState*)FMUState, size);
 }
 
 fmi3Status fmi3SerializeFMUState(fmi3Instance instance,
     fmi3FMUState FMUState,
     fmi3Byte serializedState[],
     size_t size) {
-    NOT_IMPLEMENTED;
+
+    GET_SYSTEM;
+
+    return serializeSystemState(s, (SystemState*)FMUState, (char*)serializedState, size);
 }
 
 fmi3Status fmi3DeserializeFMUState(fmi3Instance instance,
     const fmi3Byte serializedState[],
     size_t size,
     fmi3FMUState* FMUState) {
-    NOT_IMPLEMENTED;
+
+    GET_SYSTEM;
+
+    return deserializeSystemState(s, (const char*)serializedState, size, (SystemState**)FMUState);
 }
 
 fmi3Status fmi3GetDirectionalDerivative(fmi3Instance instance,
@@ -614,7 +640,35 @@ fmi3Status fmi3UpdateDiscreteStates(fmi3Instance instance,
     *valuesOfContinuousStatesChanged = fmi3False;
     *nextEventTimeDefined = fmi3False;
 
-    return FMIOK;
+    for (size_t i = 0; i < s->nComponents; i++) {
+
+        FMIInstance* m = s->components[i]->instance;
+
+        if (!s->components[i]->eventModeUsed) {
+            continue;
+        }
+
+        fmi3Boolean needsUpdate = fmi3False;
+        fmi3Boolean terminate = fmi3False;
+        fmi3Boolean nominalsChanged = fmi3False;
+        fmi3Boolean valuesChanged = fmi3False;
+        fmi3Boolean timeDefined = fmi3False;
+        fmi3Float64 time = 0;
+
+        CHECK_STATUS(FMI3UpdateDiscreteStates(m, &needsUpdate, &terminate, &nominalsChanged, &valuesChanged, &timeDefined, &time));
+
+        *discreteStatesNeedUpdate |= needsUpdate;
+        *terminateSimulation |= terminate;
+
+        // the container has no continuous states
+        if (timeDefined && (!*nextEventTimeDefined || time < *nextEventTime)) {
+            *nextEventTimeDefined = fmi3True;
+            *nextEventTime = time;
+        }
+    }
+
+END:
+    return status;
 }
 
 /***************************************************
@@ -681,15 +735,8 @@ fmi3Status fmi3EnterStepMode(fmi3Instance instance) {
     GET_SYSTEM;
 
     for (size_t i = 0; i < s->nComponents; i++) {
-        FMIInstance* m = s->components[i]->instance;
-        switch (m->fmiMajorVersion) {
-        case FMIMajorVersion2:
-            break;
-        case FMIMajorVersion3:
-            CHECK_STATUS(FMI3EnterStepMode(m));
-            break;
-        default:
-            break;
+        if (s->components[i]->eventModeUsed) {
+            CHECK_STATUS(FMI3EnterStepMode(s->components[i]->instance));
         }
     }
 
@@ -720,14 +767,15 @@ fmi3Status fmi3DoStep(fmi3Instance instance,
 
     System* s = (System*)instance;
 
-    s->time = currentCommunicationPoint + communicationStepSize;
+    const FMIStatus status = doStep(s, currentCommunicationPoint, communicationStepSize, noSetFMUStatePriorToCurrentPoint);
 
+    // the events of the components have been handled by the container
     *eventHandlingNeeded = fmi3False;
-    *terminateSimulation = fmi3False;
-    *earlyReturn = fmi3False;
-    *lastSuccessfulTime = s->time;
+    *terminateSimulation = s->terminateSimulation;
+    *earlyReturn = s->earlyReturn;
+    *lastSuccessfulTime = s->lastSuccessfulTime;
 
-    return doStep(s, currentCommunicationPoint, communicationStepSize, noSetFMUStatePriorToCurrentPoint);
+    return status;
 }
 
 /***************************************************
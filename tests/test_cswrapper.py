@@ -1,6 +1,9 @@
-from fmpy import read_model_description, simulate_fmu
-from fmpy.util import download_test_file
-from fmpy.cswrapper import add_cswrapper
+import re
+import shutil
+import numpy as np
+from fmpy import read_model_description, simulate_fmu, extract, instantiate_fmu
+from fmpy.util import download_test_file, read_csv
+from fmpy.cswrapper import add_cswrapper, column_colors, do_step_ensemble
 
 
 def test_cswrapper():
@@ -18,3 +21,265 @@ def test_cswrapper():
     add_cswrapper(filename, outfilename=outfilename)
 
     simulate_fmu(outfilename, fmi_type='CoSimulation')
+
+
+def test_cswrapper_sparse():
+
+    filename = 'CoupledClutches.fmu'
+
+    download_test_file('2.0', 'ModelExchange', 'MapleSim', '2016.2', 'CoupledClutches', filename)
+
+    add_cswrapper(filename, outfilename='CoupledClutches_dense.fmu', directional_derivatives=False)
+    add_cswrapper(filename, outfilename='CoupledClutches_sparse.fmu', linear_solver='sparse')
+
+    dense = simulate_fmu('CoupledClutches_dense.fmu', fmi_type='CoSimulation')
+    sparse = simulate_fmu('CoupledClutches_sparse.fmu', fmi_type='CoSimulation')
+
+    for name in dense.dtype.names[1:]:
+        assert np.allclose(dense[name], sparse[name], rtol=1e-3, atol=1e-3)
+
+
+def test_cswrapper_adams():
+
+    filename = 'CoupledClutches.fmu'
+
+    download_test_file('2.0', 'ModelExchange', 'MapleSim', '2016.2', 'CoupledClutches', filename)
+
+    add_cswrapper(filename, outfilename='CoupledClutches_bdf.fmu', relative_tolerance=1e-6)
+    add_cswrapper(filename, outfilename='CoupledClutches_adams.fmu', method='adams', relative_tolerance=1e-6)
+
+    bdf = simulate_fmu('CoupledClutches_bdf.fmu', fmi_type='CoSimulation')
+    adams = simulate_fmu('CoupledClutches_adams.fmu', fmi_type='CoSimulation')
+
+    for name in bdf.dtype.names[1:]:
+        assert np.allclose(bdf[name], adams[name], rtol=1e-3, atol=1e-3)
+
+
+def test_cswrapper_counters():
+
+    filename = 'CoupledClutches.fmu'
+
+    download_test_file('2.0', 'ModelExchange', 'MapleSim', '2016.2', 'CoupledClutches', filename)
+
+    add_cswrapper(filename, outfilename='CoupledClutches_counters.fmu')
+
+    messages = []
+
+    def logger(componentEnvironment, instanceName, status, category, message):
+        messages.append(message.decode('utf-8'))
+
+    simulate_fmu('CoupledClutches_counters.fmu', fmi_type='CoSimulation', debug_logging=True, logger=logger)
+
+    match = re.search(r'(\d+) evaluations of the derivatives and (\d+) of the event indicators with (\d+) calls of fmi2SetTime\(\) and (\d+) of fmi2SetContinuousStates\(\)', '\n'.join(messages))
+
+    assert match is not None
+
+    n_derivatives, n_event_indicators, n_set_time, n_set_continuous_states = map(int, match.groups())
+
+    assert n_derivatives > 0 and n_event_indicators > 0
+
+    # the time and states are only set if they have changed
+    assert 0 < n_set_time < n_derivatives + n_event_indicators
+    assert 0 < n_set_continuous_states < n_derivatives + n_event_indicators
+
+
+def test_cswrapper_dense_output():
+
+    filename = 'CoupledClutches.fmu'
+
+    download_test_file('2.0', 'ModelExchange', 'MapleSim', '2016.2', 'CoupledClutches', filename)
+    download_test_file('2.0', 'ModelExchange', 'MapleSim', '2016.2', 'CoupledClutches', 'CoupledClutches_in.csv')
+
+    # the inputs are set before every step
+    input = read_csv('CoupledClutches_in.csv')
+
+    add_cswrapper(filename, outfilename='CoupledClutches_interpolate.fmu', dense_output=True)
+    add_cswrapper(filename, outfilename='CoupledClutches_stop.fmu', dense_output=False)
+
+    reference = simulate_fmu(filename, fmi_type='ModelExchange', input=input, record_events=False)
+
+    for outfilename in ['CoupledClutches_interpolate.fmu', 'CoupledClutches_stop.fmu']:
+
+        result = simulate_fmu(outfilename, fmi_type='CoSimulation', input=input)
+
+        for name in reference.dtype.names[1:]:
+            assert np.allclose(result[name], reference[name], rtol=1e-3, atol=1e-3)
+
+
+def test_cswrapper_reset():
+
+    filename = 'CoupledClutches.fmu'
+
+    download_test_file('2.0', 'ModelExchange', 'MapleSim', '2016.2', 'CoupledClutches', filename)
+
+    add_cswrapper(filename, outfilename='CoupledClutches_reset.fmu')
+
+    unzipdir = extract('CoupledClutches_reset.fmu')
+    model_description = read_model_description(unzipdir)
+
+    fmu_instance = instantiate_fmu(unzipdir=unzipdir, model_description=model_description, fmi_type='CoSimulation')
+
+    result1 = simulate_fmu(unzipdir, model_description=model_description, fmu_instance=fmu_instance)
+
+    # re-use the instance
+    fmu_instance.reset()
+
+    result2 = simulate_fmu(unzipdir, model_description=model_description, fmu_instance=fmu_instance)
+
+    fmu_instance.freeInstance()
+
+    shutil.rmtree(unzipdir, ignore_errors=True)
+
+    for name in result1.dtype.names:
+        assert np.array_equal(result1[name], result2[name])
+
+
+def test_cswrapper_fmu_state(reference_fmus_dist_dir):
+
+    filename = reference_fmus_dist_dir / '2.0' / 'BouncingBall.fmu'
+
+    add_cswrapper(filename, outfilename='BouncingBall_state.fmu')
+
+    unzipdir = extract('BouncingBall_state.fmu')
+    model_description = read_model_description(unzipdir)
+
+    assert model_description.coSimulation.canGetAndSetFMUstate
+    assert model_description.coSimulation.canSerializeFMUstate
+
+    vrs = [v.valueReference for v in model_description.modelVariables if v.name in ['h', 'v']]
+
+    fmu_instance = instantiate_fmu(unzipdir, model_description, fmi_type='CoSimulation')
+
+    fmu_instance.setupExperiment(startTime=0)
+    fmu_instance.enterInitializationMode()
+    fmu_instance.exitInitializationMode()
+
+    def simulate(start_step):
+        values = []
+        for i in range(start_step, 200):
+            fmu_instance.doStep(currentCommunicationPoint=i * 0.01, communicationStepSize=0.01)
+            values.append(fmu_instance.getReal(vrs))
+        return values
+
+    # advance past the first bounce and save the state
+    for i in range(100):
+        fmu_instance.doStep(currentCommunicationPoint=i * 0.01, communicationStepSize=0.01)
+
+    state = fmu_instance.getFMUState()
+    serialized_state = fmu_instance.serializeFMUState(state)
+
+    reference = simulate(100)
+
+    # restore the state
+    fmu_instance.setFMUState(state)
+
+    result1 = simulate(100)
+
+    # restore the de-serialized state
+    fmu_instance.freeFMUState(state)
+
+    state = fmu_instance.deSerializeFMUState(serialized_state)
+    fmu_instance.setFMUState(state)
+
+    result2 = simulate(100)
+
+    fmu_instance.freeFMUState(state)
+    fmu_instance.terminate()
+    fmu_instance.freeInstance()
+
+    shutil.rmtree(unzipdir, ignore_errors=True)
+
+    assert np.allclose(result1, reference)
+    assert np.allclose(result2, reference)
+
+
+def test_cswrapper_events(reference_fmus_dist_dir):
+
+    def simulate_wrapped(model_name):
+
+        messages = []
+
+        def logger(componentEnvironment, instanceName, status, category, message):
+            messages.append(message.decode('utf-8'))
+
+        filename = reference_fmus_dist_dir / '2.0' / (model_name + '.fmu')
+
+        outfilename = model_name + '_events.fmu'
+
+        add_cswrapper(filename, outfilename=outfilename)
+
+        result = simulate_fmu(outfilename, fmi_type='CoSimulation', debug_logging=True, logger=logger)
+
+        reference = simulate_fmu(filename, fmi_type='ModelExchange', record_events=False)
+
+        match = re.search(r'(\d+) events with (\d+) restarts', '\n'.join(messages))
+
+        n_events, n_restarts = map(int, match.groups())
+
+        return result, reference, n_events, n_restarts
+
+    # CVode continues across time events
+    result, reference, n_events, n_restarts = simulate_wrapped('Stair')
+
+    assert n_events > 0
+    assert n_restarts == 0
+    assert np.array_equal(result['counter'], reference['counter'])
+
+    # and restarts at every state event
+    result, reference, n_events, n_restarts = simulate_wrapped('BouncingBall')
+
+    assert n_events > 0
+    assert n_restarts == n_events
+    assert np.allclose(result['h'], reference['h'], atol=1e-2)
+
+
+def test_cswrapper_ensemble():
+
+    filename = 'CoupledClutches.fmu'
+
+    download_test_file('2.0', 'ModelExchange', 'MapleSim', '2016.2', 'CoupledClutches', filename)
+
+    add_cswrapper(filename, outfilename='CoupledClutches_ensemble.fmu')
+
+    unzipdir = extract('CoupledClutches_ensemble.fmu')
+    model_description = read_model_description(unzipdir)
+
+    vrs = [v.valueReference for v in model_description.modelVariables if v.causality == 'output' and v.type == 'Real']
+
+    instances = [instantiate_fmu(unzipdir, model_description, fmi_type='CoSimulation') for _ in range(5)]
+
+    for instance in instances:
+        instance.setupExperiment(startTime=0)
+        instance.enterInitializationMode()
+        instance.exitInitializationMode()
+
+    # advance the first four instances together
+    values = do_step_ensemble(instances[:4], current_time=0, step_size=0.01, n_steps=100, output=vrs, threads=2)
+
+    # and the last one step by step
+    reference = []
+
+    for i in range(100):
+        instances[-1].doStep(currentCommunicationPoint=i * 0.01, communicationStepSize=0.01)
+        reference.append(instances[-1].getReal(vrs))
+
+    for instance in instances:
+        instance.terminate()
+        instance.freeInstance()
+
+    shutil.rmtree(unzipdir, ignore_errors=True)
+
+    for i in range(4):
+        assert np.array_equal(values[i], reference)
+
+
+def test_column_colors():
+
+    # tridiagonal pattern
+    colptrs = [0, 2, 5, 8, 11, 13]
+    rowvals = [0, 1, 0, 1, 2, 1, 2, 3, 2, 3, 4, 3, 4]
+
+    assert column_colors(colptrs, rowvals) == [0, 1, 2, 0, 1]
+
+    # diagonal pattern
+    assert column_colors([0, 1, 2, 3], [0, 1, 2]) == [0, 0, 0]
@@ -1,14 +1,22 @@
+import os
 import pytest
+import re
+import sys
+import time
+import numpy as np
+import shutil
+from ctypes import c_size_t, c_void_p, c_char_p, c_int, c_uint64, c_double, Structure, POINTER, byref, cast, string_at
 from itertools import product
-from fmpy import simulate_fmu, plot_result
+from fmpy import simulate_fmu, plot_result, extract, read_model_description, instantiate_fmu
+from fmpy.fmi3 import fmi3ValueReference, fmi3Binary
 from fmpy.fmucontainer import create_fmu_container, Variable, Connection, Configuration, Component, DefaultExperiment
 from fmpy.util import compile_platform_binary
 from fmpy.validation import validate_fmu
 from fmpy.model_description import Unit, BaseUnit, SimpleType, DisplayUnit, Item
 
 
-@pytest.mark.parametrize('fmi_version, parallelDoStep', product([3], [False, True]))
-def test_create_fmu_container(reference_fmus_dist_dir, fmi_version, parallelDoStep):
+@pytest.mark.parametrize('fmi_version, parallelDoStep, masterAlgorithm', product([3], [False, True], ['Jacobi', 'GaussSeidel']))
+def test_create_fmu_container(reference_fmus_dist_dir, fmi_version, parallelDoStep, masterAlgorithm):
 
     if fmi_version == 2:
         real_type = 'Real'
@@ -19,6 +27,7 @@ def test_create_fmu_container(reference_fmus_dist_dir, fmi_version, parallelDoSt
 
     configuration = Configuration(
         fmiVersion=f'{fmi_version}.0',
+        masterAlgorithm=masterAlgorithm,
         parallelDoStep=parallelDoStep,
         unitDefinitions=[
             Unit(name="rad/s", baseUnit=BaseUnit(rad=1, s=-1), displayUnits=[DisplayUnit(name='rpm', factor=9.549296585513721)]),
@@ -124,9 +133,9 @@ def test_create_fmu_container(reference_fmus_dist_dir, fmi_version, parallelDoSt
     )
 
     if parallelDoStep:
-        filename = f'FeedthroughParallel{fmi_version}.fmu'
+        filename = f'FeedthroughParallel{masterAlgorithm}{fmi_version}.fmu'
     else:
-        filename = f'FeedthroughSynchronous{fmi_version}.fmu'
+        filename = f'FeedthroughSynchronous{masterAlgorithm}{fmi_version}.fmu'
 
     create_fmu_container(configuration, filename)
 
@@ -178,4 +187,877 @@ def test_create_fmu_container(reference_fmus_dist_dir, fmi_version, parallelDoSt
     assert result['Float64_continuous_output'][-1] == 1.2
     assert result['Int32_output'][-1] == 3
     assert result['Boolean_output'][-1] == False
-    assert result['Enumeration_output'][-1] == 2
\ No newline at end of file
+    assert result['Enumeration_output'][-1] == 2
+
+@pytest.mark.parametrize('interpolation', ['Hold', 'Linear'])
+def test_multi_rate_fmu_container(reference_fmus_dist_dir, interpolation):
+
+    configuration = Configuration(
+        fmiVersion='3.0',
+        defaultExperiment=DefaultExperiment(
+            startTime='0',
+            stopTime='1',
+            stepSize='1e-2'
+        ),
+        variables=[
+            Variable(
+                type='Float64',
+                initial='calculated',
+                variability='continuous',
+                causality='output',
+                name='x',
+                mapping=[('slow', 'x')]
+            ),
+            Variable(
+                type='Float64',
+                initial='calculated',
+                variability='continuous',
+                causality='output',
+                name='y',
+                mapping=[('fast', 'Float64_continuous_output')]
+            ),
+        ],
+        components=[
+            Component(
+                filename=reference_fmus_dist_dir / '3.0' / 'Dahlquist.fmu',
+                name='slow',
+                stepSize=0.1,
+                interpolation=interpolation
+            ),
+            Component(
+                filename=reference_fmus_dist_dir / '3.0' / 'Feedthrough.fmu',
+                name='fast'
+            ),
+        ],
+        connections=[
+            Connection('slow', 'x', 'fast', 'Float64_continuous_input'),
+        ]
+    )
+
+    filename = f'DahlquistMultiRate{interpolation}.fmu'
+
+    create_fmu_container(configuration, filename)
+
+    assert not validate_fmu(filename)
+
+    result = simulate_fmu(filename,
+                          output=['x', 'y'],
+                          use_event_mode=True,
+                          stop_time=1, output_interval=1e-2)
+
+    time = result['time']
+    x = result['x']
+    y = result['y']
+
+    # the slow component steps ahead, so its output x only changes every 0.1 s
+    for i in range(10):
+        assert np.all(x[10 * i + 1:10 * i + 11] == x[10 * i + 10])
+
+    assert not np.all(x == x[0])
+
+    # the input of the fast component is set at the start of its step
+    if interpolation == 'Hold':
+        # and holds the last output of the slow component
+        assert np.array_equal(y[1:], x[:-1])
+    else:
+        # and interpolates between the communication points of the slow component
+        assert np.allclose(y[1:], np.interp(time[:-1], time[::10], x[::10]))
+        assert not np.array_equal(y[1:], x[:-1])
+
+
+@pytest.mark.parametrize('delayed, parallelDoStep', product([False, True], [False, True]))
+def test_delayed_fmu_container(reference_fmus_dist_dir, delayed, parallelDoStep):
+
+    configuration = Configuration(
+        fmiVersion='3.0',
+        masterAlgorithm='GaussSeidel',
+        parallelDoStep=parallelDoStep,
+        defaultExperiment=DefaultExperiment(
+            startTime='0',
+            stopTime='1',
+            stepSize='1e-1'
+        ),
+        variables=[
+            Variable(
+                type='Float64',
+                initial='calculated',
+                variability='continuous',
+                causality='output',
+                name='x',
+                mapping=[('source', 'x')]
+            ),
+            Variable(
+                type='Float64',
+                initial='calculated',
+                variability='continuous',
+                causality='output',
+                name='y',
+                mapping=[('sink', 'Float64_continuous_output')]
+            ),
+        ],
+        components=[
+            Component(
+                filename=reference_fmus_dist_dir / '3.0' / 'Dahlquist.fmu',
+                name='source'
+            ),
+            Component(
+                filename=reference_fmus_dist_dir / '3.0' / 'Feedthrough.fmu',
+                name='sink'
+            ),
+        ],
+        connections=[
+            Connection('source', 'x', 'sink', 'Float64_continuous_input', delayed=delayed),
+        ]
+    )
+
+    filename = f'DahlquistDelayed{delayed}{parallelDoStep}.fmu'
+
+    create_fmu_container(configuration, filename)
+
+    assert not validate_fmu(filename)
+
+    result = simulate_fmu(filename, output=['x', 'y'], use_event_mode=True, stop_time=1, output_interval=0.1)
+
+    x = result['x']
+    y = result['y']
+
+    assert not np.all(x == x[0])
+
+    if delayed:
+        # the sink gets the output of the source at the start of the step
+        assert np.array_equal(y[1:], x[:-1])
+    else:
+        # the sink is stepped after the source and gets its output at the end of the step
+        assert np.array_equal(y[1:], x[1:])
+
+
+def test_iteration_fmu_container(reference_fmus_dist_dir):
+
+    def create_container(filename, start_values, maxIterations):
+
+        configuration = Configuration(
+            fmiVersion='3.0',
+            maxIterations=maxIterations,
+            defaultExperiment=DefaultExperiment(
+                startTime='0',
+                stopTime='1',
+                stepSize='1e-1'
+            ),
+            variables=[
+                Variable(
+                    type='Float64',
+                    variability='continuous',
+                    causality='input',
+                    name=f'u{i + 1}',
+                    start=str(start),
+                    mapping=[(f'instance{i + 1}', 'Float64_continuous_input')]
+                ) for i, start in enumerate(start_values)
+            ] + [
+                Variable(
+                    type='Float64',
+                    initial='calculated',
+                    variability='continuous',
+                    causality='output',
+                    name=f'y{i + 1}',
+                    mapping=[(f'instance{i + 1}', 'Float64_continuous_output')]
+                ) for i in range(2)
+            ],
+            components=[
+                Component(
+                    filename=reference_fmus_dist_dir / '3.0' / 'Feedthrough.fmu',
+                    name=f'instance{i + 1}'
+                ) for i in range(2)
+            ],
+            # algebraic loop
+            connections=[
+                Connection('instance1', 'Float64_continuous_output', 'instance2', 'Float64_continuous_input'),
+                Connection('instance2', 'Float64_continuous_output', 'instance1', 'Float64_continuous_input'),
+            ]
+        )
+
+        create_fmu_container(configuration, filename)
+
+        assert not validate_fmu(filename)
+
+    def simulate(filename):
+
+        messages = []
+
+        def logger(instanceEnvironment, status, category, message):
+            messages.append(message.decode('utf-8'))
+
+        result = simulate_fmu(filename, output=['y1', 'y2'], use_event_mode=True, logger=logger, stop_time=1, output_interval=0.1)
+
+        return result, [m for m in messages if 'did not converge' in m]
+
+    # the start values are a fixed point of the loop
+    create_container('FeedthroughLoopConverged.fmu', start_values=[1.2, 1.2], maxIterations=5)
+
+    result, warnings = simulate('FeedthroughLoopConverged.fmu')
+
+    assert not warnings
+    assert np.all(result['y1'] == 1.2)
+    assert np.all(result['y2'] == 1.2)
+
+    # every iteration swaps the values, so the iteration reaches the limit
+    create_container('FeedthroughLoop.fmu', start_values=[1.2, 0], maxIterations=5)
+    create_container('FeedthroughLoopReference.fmu', start_values=[1.2, 0], maxIterations=None)
+
+    result, warnings = simulate('FeedthroughLoop.fmu')
+    reference, _ = simulate('FeedthroughLoopReference.fmu')
+
+    assert len(warnings) == len(result) - 1
+    assert 'did not converge in 5 iterations' in warnings[0]
+
+    # an odd number of iterations gives the same result as a single step
+    assert np.array_equal(result['y1'], reference['y1'])
+    assert np.array_equal(result['y2'], reference['y2'])
+
+
+def test_fmu_container_state(reference_fmus_dist_dir):
+
+    configuration = Configuration(
+        fmiVersion='3.0',
+        defaultExperiment=DefaultExperiment(
+            startTime='0',
+            stopTime='1',
+            stepSize='1e-2'
+        ),
+        variables=[
+            Variable(
+                type='Float64',
+                initial='calculated',
+                variability='continuous',
+                causality='output',
+                name='h',
+                mapping=[('ball', 'h')]
+            ),
+        ],
+        components=[
+            Component(
+                filename=reference_fmus_dist_dir / '3.0' / 'BouncingBall.fmu',
+                name='ball'
+            ),
+        ]
+    )
+
+    filename = 'BouncingBallContainer.fmu'
+
+    create_fmu_container(configuration, filename)
+
+    assert not validate_fmu(filename)
+
+    serialization_time = 0.6
+    serialized_state = None
+
+    def save_state(time, recorder):
+        """ serialize the state and stop the simulation """
+
+        nonlocal serialization_time, serialized_state
+
+        if time < serialization_time:
+            return True
+
+        fmu = recorder.fmu
+        state = fmu.getFMUState()
+
+        serialization_time = time
+        serialized_state = fmu.serializeFMUState(state)
+
+        fmu.freeFMUState(state)
+
+        return False
+
+    result1 = simulate_fmu(filename, output=['h'], stop_time=1, step_finished=save_state)
+
+    result2 = simulate_fmu(filename, output=['h'], start_time=serialization_time, stop_time=1, fmu_state=serialized_state)
+
+    assert result1[-1] == result2[0]
+
+
+def test_fmu_container_state_benchmark(reference_fmus_dist_dir, record_property):
+    """ measure the cost of a snapshot/restore cycle (recorded as properties of the test) """
+
+    configuration = Configuration(
+        fmiVersion='3.0',
+        defaultExperiment=DefaultExperiment(
+            startTime='0',
+            stopTime='1',
+            stepSize='1e-2'
+        ),
+        variables=[
+            Variable(
+                type='Float64',
+                initial='calculated',
+                variability='continuous',
+                causality='output',
+                name='h',
+                mapping=[('ball', 'h')]
+            ),
+        ],
+        components=[
+            Component(
+                filename=reference_fmus_dist_dir / '3.0' / 'BouncingBall.fmu',
+                name='ball'
+            ),
+        ]
+    )
+
+    filename = 'BouncingBallContainerBenchmark.fmu'
+
+    create_fmu_container(configuration, filename)
+
+    unzipdir = extract(filename)
+    model_description = read_model_description(unzipdir)
+
+    vr = [v.valueReference for v in model_description.modelVariables if v.name == 'h']
+
+    fmu_instance = instantiate_fmu(unzipdir, model_description, fmi_type='CoSimulation', event_mode_used=True)
+
+    fmu_instance.enterInitializationMode()
+    fmu_instance.exitInitializationMode()
+    fmu_instance.updateDiscreteStates()
+    fmu_instance.enterStepMode()
+
+    for i in range(50):
+        fmu_instance.doStep(currentCommunicationPoint=i * 1e-2, communicationStepSize=1e-2)
+
+    n_cycles = 100
+
+    # snapshot, step and restore
+    state = fmu_instance.getFMUState()
+
+    fmu_instance.doStep(currentCommunicationPoint=0.5, communicationStepSize=1e-2)
+    reference = fmu_instance.getFloat64(vr)
+
+    fmu_instance.setFMUState(state)
+
+    start = time.perf_counter()
+
+    for _ in range(n_cycles):
+        fmu_instance.freeFMUState(state)
+        state = fmu_instance.getFMUState()
+        fmu_instance.setFMUState(state)
+
+    snapshot_restore_time = (time.perf_counter() - start) / n_cycles
+
+    start = time.perf_counter()
+
+    for _ in range(n_cycles):
+        serialized_state = fmu_instance.serializeFMUState(state)
+        fmu_instance.freeFMUState(state)
+        state = fmu_instance.deserializeFMUState(serialized_state)
+
+    serialization_time = (time.perf_counter() - start) / n_cycles
+
+    # the restored state reproduces the step
+    fmu_instance.setFMUState(state)
+    fmu_instance.doStep(currentCommunicationPoint=0.5, communicationStepSize=1e-2)
+
+    assert fmu_instance.getFloat64(vr) == reference
+
+    fmu_instance.freeFMUState(state)
+    fmu_instance.terminate()
+    fmu_instance.freeInstance()
+
+    shutil.rmtree(unzipdir, ignore_errors=True)
+
+    record_property('snapshot_restore_time', snapshot_restore_time)
+    record_property('serialization_time', serialization_time)
+    record_property('serialized_state_size', len(serialized_state))
+
+    assert snapshot_restore_time > 0
+    assert serialization_time > 0
+
+
+@pytest.mark.skipif(not sys.platform.startswith('linux'), reason="uses /proc/self/maps")
+def test_shared_configuration_fmu_container(reference_fmus_dist_dir):
+
+    configuration = Configuration(
+        fmiVersion='3.0',
+        defaultExperiment=DefaultExperiment(
+            startTime='0',
+            stopTime='1',
+            stepSize='1e-1'
+        ),
+        variables=[
+            Variable(
+                type='Float64',
+                variability='continuous',
+                causality='input',
+                name='u',
+                start='1.1',
+                mapping=[('instance1', 'Float64_continuous_input')]
+            ),
+            Variable(
+                type='Float64',
+                initial='calculated',
+                variability='continuous',
+                causality='output',
+                name='y',
+                mapping=[('instance2', 'Float64_continuous_output')]
+            ),
+        ],
+        components=[
+            Component(
+                filename=reference_fmus_dist_dir / '3.0' / 'Feedthrough.fmu',
+                name='instance1'
+            ),
+            Component(
+                filename=reference_fmus_dist_dir / '3.0' / 'Feedthrough.fmu',
+                name='instance2'
+            ),
+        ],
+        connections=[
+            Connection('instance1', 'Float64_continuous_output', 'instance2', 'Float64_continuous_input'),
+        ]
+    )
+
+    filename = 'FeedthroughShared.fmu'
+
+    create_fmu_container(configuration, filename)
+
+    unzipdir = extract(filename)
+    model_description = read_model_description(unzipdir)
+
+    config_path = os.path.realpath(os.path.join(unzipdir, 'resources', 'config.bin'))
+
+    def mappings():
+        """ number of memory mappings of the configuration in this process """
+        with open('/proc/self/maps') as f:
+            return sum(1 for line in f if line.rstrip().endswith(config_path))
+
+    def simulate(fmu_instance, u):
+        result = simulate_fmu(unzipdir, model_description=model_description, fmu_instance=fmu_instance,
+                              start_values={'u': u}, output=['y'], use_event_mode=True, stop_time=1)
+        return result['y'][-1]
+
+    def instantiate():
+        return instantiate_fmu(unzipdir, model_description, fmi_type='CoSimulation', event_mode_used=True)
+
+    # two instances alive at the same time share one configuration
+    instance1 = instantiate()
+    instance2 = instantiate()
+
+    assert mappings() == 1
+
+    assert simulate(instance1, 1.2) == 1.2
+    assert simulate(instance2, 1.3) == 1.3
+
+    instance1.freeInstance()
+
+    assert mappings() == 1
+
+    instance2.freeInstance()
+
+    # the configuration is released with the last instance
+    assert mappings() == 0
+
+    # and read again for a fresh instance
+    instance3 = instantiate()
+
+    assert mappings() == 1
+    assert simulate(instance3, 1.4) == 1.4
+
+    instance3.freeInstance()
+
+    assert mappings() == 0
+
+    shutil.rmtree(unzipdir, ignore_errors=True)
+
+
+def test_fan_out_fmu_container(reference_fmus_dist_dir):
+
+    configuration = Configuration(
+        fmiVersion='3.0',
+        defaultExperiment=DefaultExperiment(
+            startTime='0',
+            stopTime='1',
+            stepSize='1e-2'
+        ),
+        variables=[
+            Variable(
+                type='Float64',
+                variability='continuous',
+                causality='input',
+                name='u',
+                start='1.1',
+                mapping=[('instance1', 'Float64_continuous_input'), ('instance2', 'Float64_continuous_input')]
+            ),
+            Variable(
+                type='Float64',
+                initial='calculated',
+                variability='continuous',
+                causality='output',
+                name='y1',
+                mapping=[('instance1', 'Float64_continuous_output')]
+            ),
+            Variable(
+                type='Float64',
+                initial='calculated',
+                variability='continuous',
+                causality='output',
+                name='y2',
+                mapping=[('instance2', 'Float64_continuous_output')]
+            ),
+        ],
+        components=[
+            Component(
+                filename=reference_fmus_dist_dir / '3.0' / 'Feedthrough.fmu',
+                name='instance1'
+            ),
+            Component(
+                filename=reference_fmus_dist_dir / '3.0' / 'Feedthrough.fmu',
+                name='instance2'
+            ),
+        ]
+    )
+
+    filename = 'FeedthroughFanOut.fmu'
+
+    create_fmu_container(configuration, filename)
+
+    assert not validate_fmu(filename)
+
+    # the start value is set on both components
+    result = simulate_fmu(filename, output=['y1', 'y2'], use_event_mode=True, stop_time=1, output_interval=1)
+
+    assert result['y1'][-1] == 1.1
+    assert result['y2'][-1] == 1.1
+
+    # and so are the inputs
+    result = simulate_fmu(filename, start_values={'u': 1.2}, output=['y1', 'y2'], use_event_mode=True, stop_time=1, output_interval=1)
+
+    assert result['y1'][-1] == 1.2
+    assert result['y2'][-1] == 1.2
+
+
+def test_binary_fmu_container(reference_fmus_dist_dir):
+
+    configuration = Configuration(
+        fmiVersion='3.0',
+        defaultExperiment=DefaultExperiment(
+            startTime='0',
+            stopTime='1',
+            stepSize='1e-2'
+        ),
+        variables=[
+            Variable(
+                type='Binary',
+                variability='discrete',
+                causality='input',
+                name='Binary_input',
+                mapping=[('instance1', 'Binary_input')]
+            ),
+            Variable(
+                type='Binary',
+                variability='discrete',
+                causality='output',
+                name='Binary_output',
+                mapping=[('instance2', 'Binary_output')]
+            ),
+        ],
+        components=[
+            Component(
+                filename=reference_fmus_dist_dir / '3.0' / 'Feedthrough.fmu',
+                name='instance1'
+            ),
+            Component(
+                filename=reference_fmus_dist_dir / '3.0' / 'Feedthrough.fmu',
+                name='instance2'
+            ),
+        ],
+        connections=[
+            Connection('instance1', 'Binary_output', 'instance2', 'Binary_input'),
+        ]
+    )
+
+    filename = 'FeedthroughBinary.fmu'
+
+    create_fmu_container(configuration, filename)
+
+    assert not validate_fmu(filename)
+
+    unzipdir = extract(filename)
+    model_description = read_model_description(unzipdir)
+
+    vrs = dict((v.name, v.valueReference) for v in model_description.modelVariables)
+
+    fmu_instance = instantiate_fmu(unzipdir, model_description, fmi_type='CoSimulation', event_mode_used=True)
+
+    payload = b'\x01\x02\xab\xcd\xef'
+
+    fmu_instance.enterInitializationMode()
+    fmu_instance.setBinary([vrs['Binary_input']], [payload])
+    fmu_instance.exitInitializationMode()
+    fmu_instance.updateDiscreteStates()
+    fmu_instance.enterStepMode()
+
+    fmu_instance.doStep(currentCommunicationPoint=0, communicationStepSize=1e-2)
+
+    # get the size and the value of the output of instance2
+    vr = (fmi3ValueReference * 1)(vrs['Binary_output'])
+    size = (c_size_t * 1)()
+    value = (fmi3Binary * 1)()
+
+    fmu_instance.fmi3GetBinary(fmu_instance.component, vr, 1, size, value, 1)
+
+    # binaries are not null-terminated
+    actual = string_at(cast(value, POINTER(c_void_p))[0], size[0])
+
+    fmu_instance.terminate()
+    fmu_instance.freeInstance()
+
+    shutil.rmtree(unzipdir, ignore_errors=True)
+
+    assert size[0] == len(payload)
+    assert actual == payload
+
+
+def test_array_fmu_container(reference_fmus_dist_dir):
+
+    configuration = Configuration(
+        fmiVersion='3.0',
+        defaultExperiment=DefaultExperiment(
+            startTime='0',
+            stopTime='1',
+            stepSize='1e-2'
+        ),
+        components=[
+            Component(
+                filename=reference_fmus_dist_dir / '3.0' / 'StateSpace.fmu',
+                name='instance1'
+            ),
+            Component(
+                filename=reference_fmus_dist_dir / '3.0' / 'StateSpace.fmu',
+                name='instance2'
+            ),
+        ],
+        connections=[
+            Connection('instance1', 'y', 'instance2', 'u'),
+        ]
+    )
+
+    filename = 'StateSpaceArray.fmu'
+
+    create_fmu_container(configuration, filename)
+
+    assert not validate_fmu(filename)
+
+    model_description = read_model_description(reference_fmus_dist_dir / '3.0' / 'StateSpace.fmu')
+
+    variables = dict((v.name, v) for v in model_description.modelVariables)
+
+    messages = []
+
+    def logger(instanceEnvironment, status, category, message):
+        messages.append(message.decode('utf-8'))
+
+    unzipdir = extract(filename)
+
+    fmu_instance = instantiate_fmu(unzipdir, read_model_description(unzipdir), fmi_type='CoSimulation',
+                                   debug_logging=True, logger=logger, event_mode_used=True)
+
+    fmu_instance.enterInitializationMode()
+    fmu_instance.exitInitializationMode()
+    fmu_instance.updateDiscreteStates()
+    fmu_instance.enterStepMode()
+
+    for i in range(10):
+        fmu_instance.doStep(currentCommunicationPoint=i * 1e-2, communicationStepSize=1e-2)
+
+    fmu_instance.terminate()
+    fmu_instance.freeInstance()
+
+    shutil.rmtree(unzipdir, ignore_errors=True)
+
+    def logged_values(instance, function, variable):
+        """ values of the last logged call of a component that gets or sets only the given variable """
+        pattern = re.compile(rf'\[{instance}\] {function}\(.*valueReferences=\{{{variable.valueReference}\}}.*values=\{{([^}}]*)\}}')
+        matches = [m for m in map(pattern.search, messages) if m]
+        return [float(value) for value in matches[-1].group(1).split(',')]
+
+    # the array is retrieved and set as a whole
+    y = logged_values('instance1', 'fmi3GetFloat64', variables['y'])
+    u = logged_values('instance2', 'fmi3SetFloat64', variables['u'])
+
+    assert len(y) == 3
+    assert u == y
+
+    # variables with different shapes can't be connected
+    configuration.components[1] = Component(filename=reference_fmus_dist_dir / '3.0' / 'Feedthrough.fmu', name='instance2')
+    configuration.connections[0] = Connection('instance1', 'y', 'instance2', 'Float64_continuous_input')
+
+    with pytest.raises(Exception, match='different shapes'):
+        create_fmu_container(configuration, 'StateSpaceShapes.fmu')
+
+
+def test_early_return_fmu_container(reference_fmus_dist_dir):
+
+    configuration = Configuration(
+        fmiVersion='3.0',
+        defaultExperiment=DefaultExperiment(
+            startTime='0',
+            stopTime='1',
+            stepSize='1e-1'
+        ),
+        variables=[
+            Variable(
+                type='Float64',
+                initial='calculated',
+                variability='continuous',
+                causality='output',
+                name='h',
+                mapping=[('ball', 'h')]
+            ),
+            Variable(
+                type='Float64',
+                initial='calculated',
+                variability='continuous',
+                causality='output',
+                name='v',
+                mapping=[('ball', 'v')]
+            ),
+        ],
+        components=[
+            Component(
+                filename=reference_fmus_dist_dir / '3.0' / 'BouncingBall.fmu',
+                name='ball'
+            ),
+        ]
+    )
+
+    filename = 'BouncingBallEarlyReturn.fmu'
+
+    create_fmu_container(configuration, filename)
+
+    assert not validate_fmu(filename)
+
+    unzipdir = extract(filename)
+    model_description = read_model_description(unzipdir)
+
+    assert model_description.coSimulation.mightReturnEarlyFromDoStep
+
+    vrs = dict((v.name, v.valueReference) for v in model_description.modelVariables)
+
+    fmu_instance = instantiate_fmu(unzipdir, model_description, fmi_type='CoSimulation', event_mode_used=True, early_return_allowed=True)
+
+    fmu_instance.enterInitializationMode()
+    fmu_instance.exitInitializationMode()
+    fmu_instance.updateDiscreteStates()
+    fmu_instance.enterStepMode()
+
+    time = 0
+
+    # step until the ball hits the ground
+    while True:
+        v_before = fmu_instance.getFloat64([vrs['v']])[0]
+        _, _, early_return, last_successful_time = fmu_instance.doStep(currentCommunicationPoint=time, communicationStepSize=0.1)
+        if early_return:
+            break
+        time += 0.1
+        assert time < 1
+
+    h, v = fmu_instance.getFloat64([vrs['h'], vrs['v']])
+
+    fmu_instance.terminate()
+    fmu_instance.freeInstance()
+
+    shutil.rmtree(unzipdir, ignore_errors=True)
+
+    # the container stopped inside the step at the time of the first bounce
+    assert time < last_successful_time < time + 0.1
+    assert abs(last_successful_time - (2 / 9.81) ** 0.5) < 1e-2
+
+    # and the event has been handled
+    assert v_before < 0
+    assert v > 0
+    assert abs(h) < 1e-2
+
+
+def test_statistics_fmu_container(reference_fmus_dist_dir):
+
+    class Histogram(Structure):
+        _fields_ = [('count', c_uint64), ('total', c_double), ('min', c_double), ('max', c_double), ('bins', c_uint64 * 32)]
+
+    class ComponentStatistics(Structure):
+        _fields_ = [('doStepWallTime', Histogram), ('doStepCPUTime', Histogram), ('transferTime', Histogram), ('waitTime', Histogram)]
+
+    configuration = Configuration(
+        fmiVersion='3.0',
+        statistics=True,
+        defaultExperiment=DefaultExperiment(
+            startTime='0',
+            stopTime='1',
+            stepSize='1e-1'
+        ),
+        components=[
+            Component(
+                filename=reference_fmus_dist_dir / '3.0' / 'Feedthrough.fmu',
+                name='instance1'
+            ),
+            Component(
+                filename=reference_fmus_dist_dir / '3.0' / 'Feedthrough.fmu',
+                name='instance2'
+            ),
+        ],
+        connections=[
+            Connection('instance1', 'Float64_continuous_output', 'instance2', 'Float64_continuous_input'),
+        ]
+    )
+
+    filename = 'FeedthroughStatistics.fmu'
+
+    create_fmu_container(configuration, filename)
+
+    unzipdir = extract(filename)
+    model_description = read_model_description(unzipdir)
+
+    messages = []
+
+    def logger(instanceEnvironment, status, category, message):
+        messages.append((category.decode('utf-8'), message.decode('utf-8')))
+
+    fmu_instance = instantiate_fmu(unzipdir, model_description, fmi_type='CoSimulation', event_mode_used=True, logger=logger)
+
+    fmu_instance.enterInitializationMode()
+    fmu_instance.exitInitializationMode()
+    fmu_instance.updateDiscreteStates()
+    fmu_instance.enterStepMode()
+
+    for i in range(10):
+        fmu_instance.doStep(currentCommunicationPoint=i * 0.1, communicationStepSize=0.1)
+
+    get_component_statistics = fmu_instance.dll.FMUContainerGetComponentStatistics
+    get_component_statistics.argtypes = [c_void_p, c_size_t, POINTER(c_char_p), POINTER(ComponentStatistics)]
+    get_component_statistics.restype = c_int
+
+    for index, name in enumerate(['instance1', 'instance2']):
+
+        component_name = c_char_p()
+        statistics = ComponentStatistics()
+
+        assert get_component_statistics(fmu_instance.component, index, byref(component_name), byref(statistics)) == 0
+
+        assert component_name.value.decode('utf-8') == name
+        assert statistics.doStepWallTime.count == 10
+        assert statistics.doStepWallTime.total > 0
+        assert sum(statistics.doStepWallTime.bins) == 10
+        assert statistics.doStepCPUTime.count == 10
+        assert statistics.transferTime.count > 0
+
+    # there is no third component
+    assert get_component_statistics(fmu_instance.component, 2, None, None) != 0
+
+    fmu_instance.terminate()
+    fmu_instance.freeInstance()
+
+    shutil.rmtree(unzipdir, ignore_errors=True)
+
+    # the summary is logged when the instance is freed
+    summary = [message for category, message in messages if category == 'logStatistics']
+
+    assert len(summary) == 3
+    assert summary[0].startswith('doStep: 10 calls')
+    assert summary[1].startswith('instance1: 10 steps')
+    assert summary[2].startswith('instance2: 10 steps')